@@ -8,6 +8,7 @@
 #include <string>
 #include <cstdlib>
 #include <algorithm>
+#include <map>
 
 // GL Error checking
 #include "check_error_gl.h"
@@ -273,4 +274,102 @@ inline GLuint LoadShaders(const char * vertex_file_path,
                vertex_file_path, fragment_file_path, geometry_file_path);
     return status;
 }
+
+// inserts a '#define' line for each name right after the '#version' line,
+// which has to stay the first statement of the shader
+inline string InjectDefines(const string &code, const vector<string> &defines) {
+    string lines;
+    for (size_t i = 0; i < defines.size(); i++) {
+        lines += "#define " + defines[i] + "\n";
+    }
+
+    size_t version = code.find("#version");
+    if(version == string::npos) {
+        return lines + code;
+    }
+    size_t line_end = code.find('\n', version);
+    if(line_end == string::npos) {
+        return code + "\n" + lines;
+    }
+    return code.substr(0, line_end + 1) + lines + code.substr(line_end + 1);
+}
+
+// programs compiled by LoadShaders with defines, by file names and defines
+struct CachedProgram {
+    GLuint program_id;
+    int users;
+};
+
+inline map<string, CachedProgram>& ProgramCache() {
+    static map<string, CachedProgram> cache;
+    return cache;
+}
+
+// compiles a permutation of the given shaders, with the given names defined
+// for the preprocessor. permutations are compiled once and shared, release
+// them with ReleaseShaders instead of glDeleteProgram.
+inline GLuint LoadShaders(const char * vertex_file_path,
+                          const char * fragment_file_path,
+                          const vector<string> &defines) {
+    const int SHADER_LOAD_FAILED = 0;
+
+    string key = string(vertex_file_path) + "|" + fragment_file_path;
+    for (size_t i = 0; i < defines.size(); i++) {
+        key += "|" + defines[i];
+    }
+    map<string, CachedProgram>::iterator cached = ProgramCache().find(key);
+    if(cached != ProgramCache().end()) {
+        cached->second.users++;
+        return cached->second.program_id;
+    }
+
+    string vertex_shader_code, fragment_shader_code;
+    {
+        ifstream vertex_shader_stream(vertex_file_path, ios::in);
+        if(!vertex_shader_stream.is_open()) {
+            printf("Could not open file: %s\n", vertex_file_path);
+            return SHADER_LOAD_FAILED;
+        }
+        vertex_shader_code = string(istreambuf_iterator<char>(vertex_shader_stream),
+                                    istreambuf_iterator<char>());
+
+        ifstream fragment_shader_stream(fragment_file_path, ios::in);
+        if(!fragment_shader_stream.is_open()) {
+            printf("Could not open file: %s\n", fragment_file_path);
+            return SHADER_LOAD_FAILED;
+        }
+        fragment_shader_code = string(istreambuf_iterator<char>(fragment_shader_stream),
+                                      istreambuf_iterator<char>());
+    }
+
+    vertex_shader_code = InjectDefines(vertex_shader_code, defines);
+    fragment_shader_code = InjectDefines(fragment_shader_code, defines);
+
+    GLuint program_id = CompileShaders(vertex_shader_code.c_str(),
+                                       fragment_shader_code.c_str());
+    if(program_id == SHADER_LOAD_FAILED) {
+        printf("Failed linking:\n  vshader: %s\n  fshader: %s\n  permutation: %s\n",
+               vertex_file_path, fragment_file_path, key.c_str());
+        return SHADER_LOAD_FAILED;
+    }
+
+    CachedProgram program = { program_id, 1 };
+    ProgramCache()[key] = program;
+    return program_id;
+}
+
+// deletes a program loaded with defines once its last user releases it
+inline void ReleaseShaders(GLuint program_id) {
+    map<string, CachedProgram> &cache = ProgramCache();
+    for (map<string, CachedProgram>::iterator it = cache.begin(); it != cache.end(); ++it) {
+        if(it->second.program_id == program_id) {
+            if(--it->second.users == 0) {
+                glDeleteProgram(program_id);
+                cache.erase(it);
+            }
+            return;
+        }
+    }
+    glDeleteProgram(program_id);
+}
 }
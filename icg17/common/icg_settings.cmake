@@ -76,7 +76,10 @@ endif()
 # to problems if an older glm version is already installed).
 add_definitions(-DGLM_FORCE_RADIANS)
 
+# Threads (asset loading runs on worker threads)
+find_package(Threads REQUIRED)
+
 # Common headers/libraries for all the exercises
 include_directories(${CMAKE_CURRENT_LIST_DIR})
-SET(COMMON_LIBS ${OPENGL_LIBRARIES} ${GLFW3_LIBRARIES} ${GLEW_LIBRARIES})
+SET(COMMON_LIBS ${OPENGL_LIBRARIES} ${GLFW3_LIBRARIES} ${GLEW_LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
 
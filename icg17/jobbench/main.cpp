@@ -0,0 +1,127 @@
+// Micro-benchmarks of the job system, from one thread to one per core: how
+// many empty jobs it runs per second, a parallel loop over a 2048 x 2048 grid
+// and a recursive split (parent and child jobs, stolen between workers).
+// Every run is repeated and the fastest one kept.
+//
+//   jobbench [max threads] [repetitions]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../project/threading/job_system.h"
+
+using namespace std;
+
+static const int GRID_SIZE = 2048;
+static const int EMPTY_JOBS = 100000;
+
+typedef chrono::high_resolution_clock Clock;
+
+// about as much arithmetic per cell as a few octaves of noise
+static float Cell(int i, int j) {
+    float x = i * 0.01f;
+    float y = j * 0.01f;
+    float value = 0.0f;
+    for (int octave = 0; octave < 8; octave++) {
+        value += sin(x) * cos(y);
+        x *= 1.9f;
+        y *= 2.1f;
+    }
+    return value;
+}
+
+// children of one root, nothing else
+static void EmptyJobs(JobSystem &jobs) {
+    JobHandle root = jobs.Create(function<void()>());
+    for (int i = 0; i < EMPTY_JOBS; i++) {
+        jobs.Run(jobs.Create([] {}, root));
+    }
+    jobs.Run(root);
+    jobs.Wait(root);
+}
+
+// rows of 32 cells high, one tile each
+static void Grid(JobSystem &jobs, vector<float> &cells) {
+    Range2D range = { 0, GRID_SIZE, 0, GRID_SIZE };
+    jobs.ParallelFor(range, GRID_SIZE, 32, [&cells](const Range2D &part) {
+        for (int j = part.y_begin; j < part.y_end; j++) {
+            for (int i = part.x_begin; i < part.x_end; i++) {
+                cells[j * GRID_SIZE + i] = Cell(i, j);
+            }
+        }
+    });
+}
+
+// sums [begin, end) of 'values', half of it in a job others can steal
+static double Sum(JobSystem &jobs, const vector<float> &values, int begin, int end) {
+    if (end - begin <= 16384) {
+        double sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            sum += sqrt(fabs(values[i]));
+        }
+        return sum;
+    }
+    int middle = (begin + end) / 2;
+    double left = 0.0;
+    JobHandle job = jobs.Create([&jobs, &values, &left, begin, middle] {
+        left = Sum(jobs, values, begin, middle);
+    });
+    jobs.Run(job);
+    double right = Sum(jobs, values, middle, end);
+    jobs.Wait(job);
+    return left + right;
+}
+
+// the fastest of 'repetitions' runs of 'benchmark', in milliseconds
+template <typename Benchmark>
+static double Best(int repetitions, Benchmark benchmark) {
+    double best = 1e30;
+    for (int i = 0; i < repetitions; i++) {
+        Clock::time_point start = Clock::now();
+        benchmark();
+        double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+        best = min(best, ms);
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : int(thread::hardware_concurrency());
+    int repetitions = argc > 2 ? atoi(argv[2]) : 5;
+    if (max_threads <= 0 || repetitions <= 0) {
+        fprintf(stderr, "usage: %s [max threads] [repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    vector<float> cells(GRID_SIZE * GRID_SIZE);
+    double single_grid = 0.0;
+    double single_sum = 0.0;
+    printf("threads   empty jobs/s   grid ms (speedup)   split sum ms (speedup)\n");
+    // powers of two, then all the threads
+    vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    for (size_t i = 0; i < thread_counts.size(); i++) {
+        int threads = thread_counts[i];
+        JobSystem jobs;
+        jobs.Init(threads - 1);
+
+        double empty = Best(repetitions, [&jobs] { EmptyJobs(jobs); });
+        double grid = Best(repetitions, [&jobs, &cells] { Grid(jobs, cells); });
+        double sum = Best(repetitions, [&jobs, &cells] {
+            Sum(jobs, cells, 0, int(cells.size()));
+        });
+        if (threads == 1) {
+            single_grid = grid;
+            single_sum = sum;
+        }
+        printf("%7d   %12.0f   %8.2f (%5.2fx)   %12.2f (%5.2fx)\n", threads,
+               EMPTY_JOBS / empty * 1000.0, grid, single_grid / grid, sum, single_sum / sum);
+        jobs.Cleanup();
+    }
+    return EXIT_SUCCESS;
+}
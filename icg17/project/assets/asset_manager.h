@@ -0,0 +1,268 @@
+#pragma once
+#include "icg_helper.h"
+#include "../texture/image.h"
+#include "../texture/compressed_texture.h"
+#include "../renderstate/renderstate.h"
+#include "../threading/job_system.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+static const string TEXTURE_DIR = "../../textures/";
+
+// Loads every texture once, whatever the number of objects asking for it.
+// Requests hand out a texture name right away: baked textures are uploaded on
+// the spot (they only need to be memory-mapped), others are decoded by the job
+// system and streamed to the GPU through a pixel buffer object by Update(),
+// so the first frames render while the textures are still filling in.
+class AssetManager {
+
+    private:
+        // one image to decode, and where it goes once decoded
+        struct Upload {
+            string filename;
+            GLenum target;                  // GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+            GLuint texture_id;
+            int layer;
+            int size;                       // array layers and cube faces are size x size
+            std::function<Image(const Image&)> faces;   // cube maps: the decoded file to faces
+            Image image;
+            bool failed;
+        };
+
+        std::map<string, GLuint> textures_;         // request key -> texture
+        std::map<GLuint, int> remaining_layers_;    // arrays still filling in
+        int pending_ = 0;                           // uploads not finished yet
+        GLuint pixel_buffer_id_;
+
+        JobSystem* jobs_ = NULL;
+        std::vector<JobHandle> decoding_;               // decode jobs not known to be done
+        std::mutex mutex_;
+        std::deque<std::shared_ptr<Upload> > decoded_;  // waiting for the GL thread
+        std::atomic<bool> stopping_;
+
+        // runs on the job system
+        void Decode(const std::shared_ptr<Upload> &job) {
+            if(stopping_) {
+                return;
+            }
+            try {
+                if(job->target == GL_TEXTURE_2D_ARRAY) {
+                    job->image = ResampleImage(ReadImage(TEXTURE_DIR + job->filename, 3),
+                                               job->size, job->size);
+                } else {
+                    job->image = job->faces(ReadImage(TEXTURE_DIR + job->filename, 3));
+                }
+            } catch(const string &error) {
+                cerr << error << endl;
+                job->failed = true;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            decoded_.push_back(job);
+        }
+
+        void Enqueue(const string &filename, GLenum target, GLuint texture_id,
+                     int layer = 0, int size = 0,
+                     const std::function<Image(const Image&)> &faces = nullptr) {
+            std::shared_ptr<Upload> job = std::make_shared<Upload>();
+            job->filename = filename;
+            job->target = target;
+            job->texture_id = texture_id;
+            job->layer = layer;
+            job->size = size;
+            job->faces = faces;
+            job->failed = false;
+            pending_++;
+
+            // forgets the jobs that are done, before adding one more
+            for (size_t i = decoding_.size(); i > 0; i--) {
+                if(jobs_->Finished(decoding_[i - 1])) {
+                    decoding_.erase(decoding_.begin() + (i - 1));
+                }
+            }
+            decoding_.push_back(jobs_->Create([this, job] { Decode(job); }));
+            jobs_->Run(decoding_.back());
+        }
+
+        // copies a decoded image into the pixel buffer and lets the driver
+        // transfer it to the texture from there
+        void Finish(const Upload &job) {
+            pending_--;
+            bool last_layer = job.target == GL_TEXTURE_2D_ARRAY &&
+                              --remaining_layers_[job.texture_id] == 0;
+            GlState().BindTexture(GL_TEXTURE0, job.target, job.texture_id);
+            GlState().ActiveTexture(GL_TEXTURE0);
+
+            if(!job.failed) {
+                GLsizeiptr bytes = job.image.pixels.size();
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_id_);
+                // orphan the previous upload instead of waiting for it
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+                void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+                // the pixels, in the buffer or else straight from the image
+                const GLvoid* pixels = ZERO_BUFFER_OFFSET;
+                if(mapped) {
+                    memcpy(mapped, &job.image.pixels[0], bytes);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                } else {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    pixels = &job.image.pixels[0];
+                }
+
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                if(job.target == GL_TEXTURE_2D_ARRAY) {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, job.layer, job.size, job.size, 1,
+                                    GL_RGB, GL_UNSIGNED_BYTE, pixels);
+                } else {
+                    // the faces follow each other in the buffer
+                    GLsizeiptr face_bytes = bytes / 6;
+                    for (int face = 0; face < 6; face++) {
+                        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0,
+                                        job.size, job.size, GL_RGB, GL_UNSIGNED_BYTE,
+                                        (const char*) pixels + face * face_bytes);
+                    }
+                    // levels past the max level would not be generated
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 1000);
+                    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+
+            // the mip chain of an array is built once all its layers are in
+            if(last_layer) {
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 1000);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+        }
+
+    public:
+        AssetManager() : stopping_(false) {
+        }
+
+        // images are decoded on 'jobs', which has to outlive the asset manager
+        void Init(JobSystem &jobs) {
+            jobs_ = &jobs;
+            glGenBuffers(1, &pixel_buffer_id_);
+            stopping_ = false;
+        }
+
+        // the textures handed out are owned by the asset manager
+        void Cleanup() {
+            // the decodes not started yet return right away
+            stopping_ = true;
+            for (size_t i = 0; i < decoding_.size(); i++) {
+                jobs_->Wait(decoding_[i]);
+            }
+            decoding_.clear();
+            decoded_.clear();
+
+            for (std::map<string, GLuint>::iterator it = textures_.begin();
+                 it != textures_.end(); ++it) {
+                glDeleteTextures(1, &it->second);
+            }
+            textures_.clear();
+            glDeleteBuffers(1, &pixel_buffer_id_);
+        }
+
+        // a mipmapped texture array with one layer per file, resampled to
+        // size x size. black until its layers are in.
+        GLuint RequestTextureArray(const vector<string> &files, int size) {
+            string key;
+            for (size_t layer = 0; layer < files.size(); layer++) {
+                key += files[layer] + ";";
+            }
+            if(textures_.count(key)) {
+                return textures_[key];
+            }
+
+            GLuint texture_id;
+            glGenTextures(1, &texture_id);
+            textures_[key] = texture_id;
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+            vector<string> baked;
+            for (size_t layer = 0; layer < files.size(); layer++) {
+                baked.push_back(TEXTURE_DIR + BakedTextureName(files[layer]));
+            }
+            if(!LoadCompressedTextureArray(baked)) {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, size, size, GLsizei(files.size()),
+                             0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+                // only level 0 exists until the mip chain is generated
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+                remaining_layers_[texture_id] = int(files.size());
+                for (size_t layer = 0; layer < files.size(); layer++) {
+                    Enqueue(files[layer], GL_TEXTURE_2D_ARRAY, texture_id, int(layer), size);
+                }
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            return texture_id;
+        }
+
+        // a mipmapped cube map, black until it is in. 'faces' turns the
+        // decoded file (RGB) into the six size x size faces, one above the
+        // other in the GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order. it runs on
+        // the job system.
+        GLuint RequestCubeMap(const string &file, int size,
+                              const std::function<Image(const Image&)> &faces) {
+            string key = file + " (cube map)";
+            if(textures_.count(key)) {
+                return textures_[key];
+            }
+
+            GLuint texture_id;
+            glGenTextures(1, &texture_id);
+            textures_[key] = texture_id;
+            glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            for (int face = 0; face < 6; face++) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, size, size, 0,
+                             GL_RGB, GL_UNSIGNED_BYTE, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+            Enqueue(file, GL_TEXTURE_CUBE_MAP, texture_id, 0, size, faces);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            return texture_id;
+        }
+
+        // uploads at most 'max_uploads' decoded images, call once per frame
+        void Update(int max_uploads = 2) {
+            // a job system without workers only runs jobs someone waits for:
+            // decode one image per call here, or none would ever finish
+            if(jobs_->NumThreads() == 1) {
+                for (size_t i = 0; i < decoding_.size(); i++) {
+                    if(!jobs_->Finished(decoding_[i])) {
+                        jobs_->Wait(decoding_[i]);
+                        break;
+                    }
+                }
+            }
+            for (int i = 0; i < max_uploads; i++) {
+                std::shared_ptr<Upload> job;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if(decoded_.empty()) {
+                        return;
+                    }
+                    job = decoded_.front();
+                    decoded_.pop_front();
+                }
+                Finish(*job);
+            }
+        }
+
+        // true once every requested texture is on the GPU
+        bool Idle() const {
+            return pending_ == 0;
+        }
+};
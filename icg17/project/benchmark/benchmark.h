@@ -0,0 +1,136 @@
+#pragma once
+#include "icg_helper.h"
+#include "../profiler/profiler.h"
+#include <sstream>
+
+// Collects the frames of a benchmark run from the profiler, writes their
+// statistics as JSON and compares them with the JSON of an earlier run.
+// The workload itself (camera path, frame count, fixed time step) is up to
+// the caller, the frames are only comparable if it is the same every run.
+class Benchmark {
+
+    private:
+        vector<FrameRecord> records_;
+        vector<string> names_;
+
+        // the number following "key": after 'from', false if there is none
+        static bool FindNumber(const string &json, size_t from, const string &key,
+                               double &value) {
+            if (from == string::npos) {
+                return false;
+            }
+            size_t position = json.find("\"" + key + "\":", from);
+            if (position == string::npos) {
+                return false;
+            }
+            std::istringstream stream(json.substr(position + key.size() + 3, 32));
+            return bool(stream >> value);
+        }
+
+        // 'current' went up by more than 'threshold' (relative) and by more
+        // than 'floor' (absolute, keeps tiny passes from flagging noise)
+        static bool Check(const string &what, double baseline, double current,
+                          double threshold, double floor) {
+            double change = baseline > 0.0 ? (current - baseline) / baseline : 0.0;
+            bool regressed = current - baseline > std::max(threshold * baseline, floor);
+            printf("%-28s %12.3f %12.3f %+8.1f%%%s\n", what.c_str(), baseline, current,
+                   100.0 * change, regressed ? "  REGRESSION" : "");
+            return regressed;
+        }
+
+    public:
+        // starts collecting, after the warm up frames
+        void Begin(Profiler &profiler) {
+            profiler.Flush();
+            records_.clear();
+            profiler.Capture(&records_);
+        }
+
+        void End(Profiler &profiler) {
+            profiler.Flush();
+            profiler.Capture(NULL);
+            names_ = profiler.PassNames();
+        }
+
+        // 'description' is a JSON object telling how the frames were made
+        bool WriteJSON(const string &filename, const string &description) const {
+            ofstream file(filename.c_str());
+            if (!file.is_open()) {
+                return false;
+            }
+            ProfileStats stats = Profiler::Stats(records_, names_.size());
+            double primitives = 0.0;
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                primitives += stats.primitives[pass];
+            }
+
+            file << "{\n  \"benchmark\": " << description << ",\n"
+                 << "  \"frame_ms\": " << Profiler::StatsJSON(stats.frame) << ",\n"
+                 << "  \"primitives\": " << (long long) primitives << ",\n"
+                 << "  \"state_changes\": " << stats.state_changes << ",\n"
+                 << "  \"state_skipped\": " << stats.state_skipped << ",\n"
+                 << "  \"mirror_refreshes\": " << stats.mirror_refreshes << ",\n"
+                 << "  \"mirror_reuses\": " << stats.mirror_reuses << ",\n"
+                 << "  \"passes\": [\n";
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                file << "    {\"name\": \"" << names_[pass] << "\", \"gpu_ms\": "
+                     << Profiler::StatsJSON(stats.gpu[pass]) << ", \"cpu_ms\": "
+                     << Profiler::StatsJSON(stats.cpu[pass]) << ", \"primitives\": "
+                     << (long long) stats.primitives[pass] << ", \"fragments\": "
+                     << (long long) stats.fragments[pass] << "}"
+                     << (pass + 1 < names_.size() ? "," : "") << "\n";
+            }
+            file << "  ]\n}\n";
+            return true;
+        }
+
+        // prints the frame times, the GPU time, the primitives and the
+        // fragments (where both runs counted them) of every pass next to the
+        // ones of 'baseline' (a file written by WriteJSON), returns the number
+        // of regressions, -1 if the baseline can't be read
+        int Compare(const string &baseline, float threshold) const {
+            ifstream file(baseline.c_str());
+            if (!file.is_open()) {
+                cerr << "could not read the baseline " << baseline << endl;
+                return -1;
+            }
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+            string json = buffer.str();
+
+            ProfileStats stats = Profiler::Stats(records_, names_.size());
+            int regressions = 0;
+            printf("%-28s %12s %12s\n", "", "baseline", "current");
+
+            const char* percentiles[] = { "avg", "p95", "p99" };
+            const float values[] = { stats.frame.avg, stats.frame.p95, stats.frame.p99 };
+            size_t frame = json.find("\"frame_ms\":");
+            for (int i = 0; i < 3; i++) {
+                double value;
+                if (FindNumber(json, frame, percentiles[i], value)) {
+                    regressions += Check(string("frame ") + percentiles[i] + " ms", value,
+                                         values[i], threshold, 0.1);
+                }
+            }
+
+            // the GPU statistics come first in every pass, the counters last
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                size_t entry = json.find("{\"name\": \"" + names_[pass] + "\"");
+                double value;
+                if (FindNumber(json, entry, "avg", value)) {
+                    regressions += Check(names_[pass] + " gpu avg ms", value,
+                                         stats.gpu[pass].avg, threshold, 0.05);
+                }
+                if (FindNumber(json, entry, "primitives", value)) {
+                    regressions += Check(names_[pass] + " primitives", value,
+                                         stats.primitives[pass], threshold, 0.0);
+                }
+                if (FindNumber(json, entry, "fragments", value) && value >= 0.0 &&
+                    stats.fragments[pass] >= 0.0) {
+                    regressions += Check(names_[pass] + " fragments", value,
+                                         stats.fragments[pass], threshold, 0.0);
+                }
+            }
+            return regressions;
+        }
+};
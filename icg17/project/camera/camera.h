@@ -1,83 +1,82 @@
 #pragma once
 #include "icg_helper.h"
+#include "spline.h"
+#include "../heightfield/heightfield.h"
 
 using namespace glm;
 
 class Camera {
 private:
-    GLuint heightmap_texture_id_;
-    int heightmap_width_;
-    int heightmap_height_;
-    float* texture_data;
-    int numberOfPathPoints = 10;
-    int numberOfCamPoints = 10;
+    const HeightField* heightfield_;
     bool isInFpsMode = false;
-    bool isInBezierMode = false;
-    float t = 0;
+    bool isInPathMode = false;
+    CameraSpline positionSpline;    // where the camera flies in path mode
+    CameraSpline lookSpline;        // where it looks meanwhile
+    float distance = 0;             // flown along positionSpline
+
+    // world units per second at full throttle
+    static constexpr float PATH_SPEED = 25.0f;
+
+    // the free camera keeps this disc above the ground, not only its center,
+    // so that the near plane does not dip into the slopes around it
+    static constexpr float FOOTPRINT_RADIUS = 0.02f;
+    static const int FOOTPRINT_POINTS = 9;
+
+    // the highest ground under the footprint of 'pos'
+    float GroundUnder(const vec3 &pos) const {
+        float x[FOOTPRINT_POINTS], z[FOOTPRINT_POINTS], heights[FOOTPRINT_POINTS];
+        x[0] = pos.x;
+        z[0] = pos.z;
+        for (int k = 1; k < FOOTPRINT_POINTS; k++) {
+            float angle = 2.0f * M_PI * (k - 1) / (FOOTPRINT_POINTS - 1);
+            x[k] = pos.x + FOOTPRINT_RADIUS * cos(angle);
+            z[k] = pos.z + FOOTPRINT_RADIUS * sin(angle);
+        }
+        heightfield_->Heights(x, z, heights, FOOTPRINT_POINTS);
+        return *std::max_element(heights, heights + FOOTPRINT_POINTS);
+    }
 
 public:
 
-    void Init(int heightmap_width, int heightmap_height, GLuint heightMap) {
-        heightmap_width_ = heightmap_width;
-        heightmap_height_ = heightmap_height;
-        this->heightmap_texture_id_ = heightMap;
-
-        texture_data = new float[heightmap_width * heightmap_height];
-        glBindTexture(GL_TEXTURE_2D, heightmap_texture_id_);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, texture_data);
+    // the camera walks on 'heightfield', which has to outlive it
+    void Init(const HeightField &heightfield) {
+        heightfield_ = &heightfield;
+
+        // positions picked with printXYZ, the camera passes through them
+        positionSpline.Init({ vec3(0.580981,0.193522,0.92752),
+                              vec3(0.434318,0.289063,0.613651),
+                              vec3(0.129593,0.311542,0.459572),
+                              vec3(0.0819179,0.295212,-0.0944423),
+                              vec3(0.0997908,0.259328,-0.54052),
+                              vec3(0.386055,0.211299,-0.285465),
+                              vec3(0.291908,0.307192,0.403216),
+                              vec3(0.279414,0.689692,0.678209),
+                              vec3(0.287024,0.285801,-0.106626),
+                              vec3(0.375611,0.224214,-0.739321) }, true);
+        lookSpline.Init({ vec3(0.395785,0.0956253,0.301178),
+                          vec3(0.12333,0.0677721,0.0410597),
+                          vec3(-0.20801,0.203461,-0.239735),
+                          vec3(0.0456409,0.257796,-0.653036),
+                          vec3(0.597478,0.0606904,-0.373088),
+                          vec3(0.638517,0.230005,0.17006),
+                          vec3(0.106359,0.388643,0.715332),
+                          vec3(0.354543,0.393108,0.193992),
+                          vec3(0.274585,0.174029,-0.594867),
+                          vec3(0.411381,0.170017,-1.00387) }, true);
     }
 
     void Cleanup() {
-        delete[] texture_data;
-    }
-
-    bool isCurrentlyInBezierMode() {
-        return isInBezierMode;
     }
 
-    vec3* initPathPoints() {
-        vec3* bezierPoints = new vec3[numberOfPathPoints];
-        bezierPoints[0] = vec3(0.580981,0.193522,0.92752);
-        bezierPoints[1] = vec3(0.434318,0.289063,0.613651);
-        bezierPoints[2] = vec3(0.129593,0.311542,0.459572);
-        bezierPoints[3] = vec3(0.0819179,0.295212,-0.0944423);
-        bezierPoints[4] = vec3(0.0997908,0.259328,-0.54052);
-        bezierPoints[5] = vec3(0.386055,0.211299,-0.285465);
-        bezierPoints[6] = vec3(0.291908,0.307192,0.403216);
-        bezierPoints[7] = vec3(0.279414,0.689692,0.678209);
-        bezierPoints[8] = vec3(0.287024,0.285801,-0.106626);
-        bezierPoints[9] = vec3(0.375611,0.224214,-0.739321);
-        return bezierPoints;
+    bool isCurrentlyInPathMode() {
+        return isInPathMode;
     }
 
-    vec3* initCamPoints() {
-        vec3* bezierPoints = new vec3[numberOfCamPoints];
-        bezierPoints[0] = vec3(0.395785,0.0956253,0.301178);
-        bezierPoints[1] = vec3(0.12333,0.0677721,0.0410597);
-        bezierPoints[2] = vec3(-0.20801,0.203461,-0.239735);
-        bezierPoints[3] = vec3(0.0456409,0.257796,-0.653036);
-        bezierPoints[4] = vec3(0.597478,0.0606904,-0.373088);
-        bezierPoints[5] = vec3(0.638517,0.230005,0.17006);
-        bezierPoints[6] = vec3(0.106359,0.388643,0.715332);
-        bezierPoints[7] = vec3(0.354543,0.393108,0.193992);
-        bezierPoints[8] = vec3(0.274585,0.174029,-0.594867);
-        bezierPoints[8] = vec3(0.411381,0.170017,-1.00387);
-        return bezierPoints;
-    }
-
-    vec3 getBezierLocation(vec3* points, int size, const float t){
-        if (size == 1) {
-            vec3 point = points[0];
-            delete [] points;
-            return point;
-        } else {
-            vec3* newpoints = new vec3[size - 1];
-            for (int i = 0; i < size - 1; i++) {
-                newpoints[i] = (1 - t) * points[i] + t * points[i+1];
-            }
-            delete [] points;
-            return getBezierLocation(newpoints, size - 1, t);
-        }
+    // Camera 'progress' (0 to 1) through its path, independent of the keyboard
+    // so that benchmarks can fly it at a fixed pace
+    void pathAt(float progress, vec3 &look, vec3 &pos) {
+        pos = positionSpline.At(progress * positionSpline.Length());
+        look = lookSpline.At(progress * lookSpline.Length());
     }
 
     // Multiply 2 coordinates of look vector by a rotation matrix
@@ -111,7 +110,8 @@ public:
     		look.y = dY + pos.y;
     }
 
-    void moveFrontBack(vec3 &look, vec3 &pos, float speed) {
+    // 'dt' is the time since the last frame, in seconds
+    void moveFrontBack(vec3 &look, vec3 &pos, float speed, float dt) {
 
         if(isInFpsMode) {
             float dX = (look.x - pos.x)*speed;
@@ -129,28 +129,21 @@ public:
                 pos.z = tmpPosZ;
                 look.z = look.z + dZ;
             }
-            //Map camera position (-1, 1) into heighmap coordinates (0,0 to ....)
-            int coordX = int((1.0+pos.x) * heightmap_width_/2.0);
-            int coordZ = int((1.0+pos.z) * heightmap_height_/2.0);
-
-            // Simple check on heighmap boundaries
-            if(coordX > 0 && coordX < heightmap_width_ && coordZ > 0 && coordZ < heightmap_height_) {
-                float height = texture_data[coordX+heightmap_width_*coordZ];
-                pos.y = height+0.05; // Extra height for fps mode
+            // bilinear, nearest texels made the camera jitter. the heights
+            // arrive a few frames after the terrain is generated
+            if (!heightfield_->Empty()) {
+                pos.y = heightfield_->Height(pos.x, pos.z) + 0.05; // Extra height for fps mode
             }
 
-        } else if(isInBezierMode) {
-            t += speed/10;
-            //cout << "t=" << t << endl;
-            //cout << "before " << look.x << " " << look.y << " " << look.z << endl;
-
-            look = getBezierLocation(initCamPoints(), numberOfCamPoints, mod(t, 1.0f));
-            //cout << "before " << look.x << " " << look.y << " " << look.z << endl;
-            pos = getBezierLocation(initPathPoints(), numberOfPathPoints, mod(t, 1.0f));
+        } else if(isInPathMode) {
+            // the look at point keeps the same progress along its own spline
+            distance += speed * PATH_SPEED * dt;
+            pathAt(distance / positionSpline.Length(), look, pos);
         } else {
             float dX = (look.x - pos.x)*speed;
     		float dY = (look.y - pos.y)*speed;
     		float dZ = (look.z - pos.z)*speed;
+            vec3 from = pos;
 
     		pos.x = pos.x + dX;
     		pos.y = pos.y + dY;
@@ -159,6 +152,22 @@ public:
     		look.x = look.x + dX;
     		look.y = look.y + dY;
     		look.z = look.z + dZ;
+
+            // a fast move can cross a whole hill: stop where it enters it
+            vec3 move = pos - from;
+            vec3 hit;
+            if (move != vec3(0.0f) && !heightfield_->Empty() &&
+                heightfield_->Raycast(from, move, 1.0f, hit)) {
+                look += hit - pos;
+                pos = hit;
+            }
+
+            // never fly into the ground
+            float ground = heightfield_->Empty() ? -FLT_MAX : GroundUnder(pos) + 0.01;
+            if (pos.y < ground) {
+                look.y += ground - pos.y;
+                pos.y = ground;
+            }
         }
     }
 
@@ -168,14 +177,14 @@ public:
     }
 
     void switchInFpsMode() {
-        isInBezierMode = false;
+        isInPathMode = false;
         isInFpsMode = !isInFpsMode;
         cout << "FPS MODE " << isInFpsMode << endl;
     }
 
-    void switchInBezierMode() {
+    void switchInPathMode() {
         isInFpsMode = false;
-        isInBezierMode = !isInBezierMode;
-        cout << "Bezier MODE " << isInBezierMode << endl;
+        isInPathMode = !isInPathMode;
+        cout << "PATH MODE " << isInPathMode << endl;
     }
 };
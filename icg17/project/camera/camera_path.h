@@ -0,0 +1,130 @@
+#pragma once
+#include "icg_helper.h"
+
+using namespace glm;
+
+// where the camera was at one frame
+struct CameraSample {
+    float time;
+    vec3 pos;
+    vec3 look;
+    vec3 up;
+};
+
+// A camera flight, one sample per rendered frame, to replay real sessions as
+// workloads. On disk: "ICGC", the version and the number of samples as 32 bit
+// integers, then the samples as 10 floats each (time, pos, look, up), all in
+// the byte order of the machine that recorded them.
+class CameraPath {
+
+    private:
+        static const unsigned VERSION = 1;
+        vector<CameraSample> samples_;
+
+    public:
+        void Clear() {
+            samples_.clear();
+        }
+
+        void Add(float time, const vec3 &pos, const vec3 &look, const vec3 &up) {
+            CameraSample sample = { time, pos, look, up };
+            samples_.push_back(sample);
+        }
+
+        size_t Size() const {
+            return samples_.size();
+        }
+
+        float Duration() const {
+            return samples_.empty() ? 0.0f : samples_.back().time - samples_.front().time;
+        }
+
+        // the camera 'time' seconds after the first sample, interpolated
+        // between the samples around it and clamped to the path
+        CameraSample At(float time) const {
+            if (samples_.empty()) {
+                throw(string("Empty camera path"));
+            }
+            time += samples_.front().time;
+            size_t next = std::lower_bound(samples_.begin(), samples_.end(), time,
+                                           [](const CameraSample &sample, float value) {
+                                               return sample.time < value;
+                                           }) - samples_.begin();
+            if (next == 0 || next == samples_.size()) {
+                return samples_[next == 0 ? 0 : next - 1];
+            }
+
+            const CameraSample &a = samples_[next - 1];
+            const CameraSample &b = samples_[next];
+            float t = (time - a.time) / std::max(b.time - a.time, 1e-6f);
+            CameraSample sample;
+            sample.time = time;
+            sample.pos = mix(a.pos, b.pos, t);
+            sample.look = mix(a.look, b.look, t);
+            sample.up = normalize(mix(a.up, b.up, t));
+            return sample;
+        }
+
+        // the 'index'th recorded sample
+        const CameraSample& Frame(size_t index) const {
+            return samples_[index];
+        }
+
+        bool Save(const string &filename) const {
+            ofstream file(filename.c_str(), ios::binary);
+            if (!file.is_open()) {
+                return false;
+            }
+            unsigned header[2] = { VERSION, unsigned(samples_.size()) };
+            file.write("ICGC", 4);
+            file.write((const char*) header, sizeof(header));
+            for (size_t i = 0; i < samples_.size(); i++) {
+                const CameraSample &sample = samples_[i];
+                float values[10] = { sample.time,
+                                     sample.pos.x, sample.pos.y, sample.pos.z,
+                                     sample.look.x, sample.look.y, sample.look.z,
+                                     sample.up.x, sample.up.y, sample.up.z };
+                file.write((const char*) values, sizeof(values));
+            }
+            return bool(file);
+        }
+
+        // replaces the samples, false (and no sample) if the file is invalid
+        bool Load(const string &filename) {
+            samples_.clear();
+            ifstream file(filename.c_str(), ios::binary);
+            char magic[4];
+            unsigned header[2];
+            if (!file.read(magic, 4) || string(magic, 4) != "ICGC" ||
+                !file.read((char*) header, sizeof(header)) || header[0] != VERSION) {
+                cerr << filename << " is not a camera path" << endl;
+                return false;
+            }
+
+            // the count must match what the file holds, before allocating it
+            std::streamoff start = file.tellg();
+            file.seekg(0, ios::end);
+            std::streamoff remaining = file.tellg() - start;
+            file.seekg(start);
+            if (remaining < 0 ||
+                std::streamoff(header[1]) * std::streamoff(10 * sizeof(float)) > remaining) {
+                cerr << filename << " is truncated" << endl;
+                return false;
+            }
+
+            samples_.resize(header[1]);
+            for (size_t i = 0; i < samples_.size(); i++) {
+                float values[10];
+                if (!file.read((char*) values, sizeof(values))) {
+                    cerr << filename << " is truncated" << endl;
+                    samples_.clear();
+                    return false;
+                }
+                samples_[i].time = values[0];
+                samples_[i].pos = vec3(values[1], values[2], values[3]);
+                samples_[i].look = vec3(values[4], values[5], values[6]);
+                samples_[i].up = vec3(values[7], values[8], values[9]);
+            }
+            return !samples_.empty();
+        }
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include "icg_helper.h"
+
+using namespace glm;
+
+// Catmull-Rom spline through control points, evaluated by distance along the
+// curve so that a camera flying it at a constant speed moves at a constant
+// speed, whatever the spacing of the points. The distance -> curve parameter
+// table is built once by Init(), At() only reads it: no allocation and a
+// fixed cost per call.
+class CameraSpline {
+
+    private:
+        static const int SAMPLES_PER_SEGMENT = 256;
+
+        vector<vec3> points_;
+        bool closed_ = false;
+        int segments_ = 0;
+        float length_ = 0.0f;
+        vector<float> parameters_;          // curve parameter at evenly spaced distances
+
+        // control point i, wrapped around a closed curve, clamped otherwise
+        const vec3& Point(int i) const {
+            int n = int(points_.size());
+            if (closed_) {
+                return points_[((i % n) + n) % n];
+            }
+            return points_[std::min(std::max(i, 0), n - 1)];
+        }
+
+        // u in [0, segments_], segment i spans [i, i + 1]
+        vec3 Evaluate(float u) const {
+            int segment = std::min(int(u), segments_ - 1);
+            float t = u - segment;
+            const vec3 &p0 = Point(segment - 1);
+            const vec3 &p1 = Point(segment);
+            const vec3 &p2 = Point(segment + 1);
+            const vec3 &p3 = Point(segment + 2);
+            return 0.5f * (2.0f * p1 + (p2 - p0) * t +
+                           (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t * t +
+                           (3.0f * p1 - p0 - 3.0f * p2 + p3) * t * t * t);
+        }
+
+    public:
+        // a closed curve goes back from the last point to the first one
+        void Init(const vector<vec3> &points, bool closed) {
+            if (points.size() < 2) {
+                throw(string("A camera spline needs at least two points"));
+            }
+            points_ = points;
+            closed_ = closed;
+            segments_ = int(points_.size()) - (closed_ ? 0 : 1);
+
+            // distance from the start at every sample of the curve
+            int samples = segments_ * SAMPLES_PER_SEGMENT;
+            vector<float> distances(samples + 1, 0.0f);
+            vec3 previous = Evaluate(0.0f);
+            for (int i = 1; i <= samples; i++) {
+                vec3 current = Evaluate(i / float(SAMPLES_PER_SEGMENT));
+                distances[i] = distances[i - 1] + glm::length(current - previous);
+                previous = current;
+            }
+            length_ = distances[samples];
+
+            // inverts it at as many evenly spaced distances
+            parameters_.resize(samples + 1);
+            int sample = 0;
+            for (int i = 0; i <= samples; i++) {
+                float distance = length_ * i / samples;
+                while (sample < samples - 1 && distances[sample + 1] < distance) {
+                    sample++;
+                }
+                float span = distances[sample + 1] - distances[sample];
+                float t = span > 0.0f ? (distance - distances[sample]) / span : 0.0f;
+                parameters_[i] = (sample + std::min(std::max(t, 0.0f), 1.0f)) /
+                                 SAMPLES_PER_SEGMENT;
+            }
+        }
+
+        float Length() const {
+            return length_;
+        }
+
+        // the point 'distance' along the curve, looping around a closed curve
+        // and clamped to the ends of an open one
+        vec3 At(float distance) const {
+            if (closed_) {
+                distance = distance - length_ * floor(distance / length_);
+            } else {
+                distance = std::min(std::max(distance, 0.0f), length_);
+            }
+            float x = distance / length_ * (parameters_.size() - 1);
+            int i = std::min(int(x), int(parameters_.size()) - 2);
+            return Evaluate(mix(parameters_[i], parameters_[i + 1], x - i));
+        }
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include "icg_helper.h"
+#include <glm/gtc/type_ptr.hpp>
+#include "../framebuffer/framebuffer.h"
+#include "../uniforms/uniform_buffer.h"
+#include "../renderstate/renderstate.h"
+
+// Deferred shading of the terrain. The terrain writes its materials into a
+// thin G-buffer (albedo and the packed Kd / Ks as RGBA8, the normal folded
+// onto an octahedron as RG16, and the depth), then one pass over the screen
+// lights every covered pixel once, however many layers of hills were drawn.
+class DeferredShading {
+
+    private:
+        GLuint vertex_array_id_;        // vertex array object, without attributes
+        GLuint program_id_;             // the lighting pass
+        GLuint framebuffer_id_;
+        GLuint albedo_texture_id_;
+        GLuint normal_texture_id_;
+        GLuint depth_texture_id_;
+        GLint inverse_projection_id_;
+        GLint inverse_model_view_id_;
+        int width_;
+        int height_;
+
+        GLuint CreateTarget(GLenum int_format, GLenum format, GLenum type) {
+            GLuint texture_id;
+            glGenTextures(1, &texture_id);
+            glBindTexture(GL_TEXTURE_2D, texture_id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, int_format, width_, height_, 0, format, type, NULL);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return texture_id;
+        }
+
+        // (re)allocates the G-buffer at the current size
+        void CreateTargets() {
+            albedo_texture_id_ = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+            normal_texture_id_ = CreateTarget(GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+            depth_texture_id_ = CreateTarget(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id_);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 /*location = 0*/,
+                                   GL_TEXTURE_2D, albedo_texture_id_, 0 /*level*/);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 /*location = 1*/,
+                                   GL_TEXTURE_2D, normal_texture_id_, 0 /*level*/);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                   GL_TEXTURE_2D, depth_texture_id_, 0 /*level*/);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                cerr << "!!!ERROR: G-buffer not OK :(" << endl;
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+        }
+
+        void DeleteTargets() {
+            glDeleteTextures(1, &albedo_texture_id_);
+            glDeleteTextures(1, &normal_texture_id_);
+            glDeleteTextures(1, &depth_texture_id_);
+        }
+
+    public:
+        void Init(int width, int height) {
+            this->width_ = width;
+            this->height_ = height;
+
+            // compile the shaders
+            program_id_ = icg_helper::LoadShaders("deferred_vshader.glsl",
+                                                  "lighting_fshader.glsl");
+            if(!program_id_) {
+                exit(EXIT_FAILURE);
+            }
+
+            // the corners come from gl_VertexID, but a vertex array has to be bound
+            glGenVertexArrays(1, &vertex_array_id_);
+
+            // the G-buffer
+            glGenFramebuffers(1, &framebuffer_id_);
+            CreateTargets();
+
+            glUseProgram(program_id_);
+            glUniform1i(glGetUniformLocation(program_id_, "albedo"), 0 /*GL_TEXTURE0*/);
+            glUniform1i(glGetUniformLocation(program_id_, "normals"), 1 /*GL_TEXTURE1*/);
+            glUniform1i(glGetUniformLocation(program_id_, "depth"), 2 /*GL_TEXTURE2*/);
+            BindUniformBlock(program_id_, "Light", LIGHT_UNIFORMS_BINDING);
+            inverse_projection_id_ = glGetUniformLocation(program_id_, "inverse_projection");
+            inverse_model_view_id_ = glGetUniformLocation(program_id_, "inverse_model_view");
+            glUseProgram(0);
+        }
+
+        void Cleanup() {
+            glBindVertexArray(0);
+            glUseProgram(0);
+            glDeleteVertexArrays(1, &vertex_array_id_);
+            glDeleteProgram(program_id_);
+            DeleteTargets();
+            glBindFramebuffer(GL_FRAMEBUFFER, 0 /*UNBIND*/);
+            glDeleteFramebuffers(1, &framebuffer_id_);
+        }
+
+        // follows the window, the G-buffer is only reallocated when its size
+        // actually changed
+        void Resize(int width, int height) {
+            if (width == width_ && height == height_) {
+                return;
+            }
+            this->width_ = width;
+            this->height_ = height;
+            DeleteTargets();
+            CreateTargets();
+        }
+
+        // the terrain drawn between BindGBuffer() and UnbindGBuffer() has to
+        // be its GBUFFER permutation. warning: overrides viewport!!
+        void BindGBuffer() {
+            glViewport(0, 0, width_, height_);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id_);
+            const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2 /*length of buffers[]*/, buffers);
+        }
+
+        // does not restore the viewport of the screen
+        void UnbindGBuffer() {
+            glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+        }
+
+        // lights the G-buffer into the bound framebuffer, color and depth, so
+        // that the sky and the water are then drawn as over the forward terrain.
+        // 'model' and 'view' the terrain was drawn with.
+        void Light(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection) {
+            GlState().UseProgram(program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Disable(GL_BLEND);
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            GlState().DepthFunc(GL_ALWAYS);
+
+            GlState().BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, albedo_texture_id_);
+            GlState().BindTexture(GL_TEXTURE1, GL_TEXTURE_2D, normal_texture_id_);
+            GlState().BindTexture(GL_TEXTURE2, GL_TEXTURE_2D, depth_texture_id_);
+
+            glm::mat4 inverse_projection = glm::inverse(projection);
+            glm::mat4 inverse_model_view = glm::inverse(view * model);
+            glUniformMatrix4fv(inverse_projection_id_, ONE, DONT_TRANSPOSE,
+                               glm::value_ptr(inverse_projection));
+            glUniformMatrix4fv(inverse_model_view_id_, ONE, DONT_TRANSPOSE,
+                               glm::value_ptr(inverse_model_view));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+};
@@ -0,0 +1,7 @@
+#version 330 core
+
+void main() {
+    // (-1, -1), (3, -1), (-1, 3): one triangle covering the screen
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
@@ -0,0 +1,61 @@
+#version 330
+// lights the G-buffer written by the terrain (terrain_fshader.glsl, GBUFFER)
+
+uniform sampler2D albedo;           // Ka, and the packed Kd and Ks
+uniform sampler2D normals;          // octahedral
+uniform sampler2D depth;
+uniform mat4 inverse_projection;
+uniform mat4 inverse_model_view;
+
+// shared by all the programs, see uniforms/uniform_buffer.h
+layout(std140) uniform Light {
+    vec3 La, Ld, Ls;
+    vec3 light_pos;
+};
+
+out vec3 color;
+
+// keep in sync with terrain_fshader.glsl
+const float materialKMax = 0.25f;
+const float default_alpha = 60.0f;
+
+vec3 decodeNormal(vec2 encoded) {
+    vec2 e = encoded * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    float z = texelFetch(depth, coord, 0).r;
+    if (z == 1.0) {
+        // nothing drawn here, the sky fills it in
+        discard;
+    }
+
+    // the point back in view space, and in model space
+    vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(depth, 0))) * 2.0 - 1.0;
+    vec4 point = inverse_projection * vec4(ndc, z * 2.0 - 1.0, 1.0);
+    vec3 vpoint_mv = point.xyz / point.w;
+    vec3 position3D = (inverse_model_view * vec4(vpoint_mv, 1.0)).xyz;
+    vec3 light_dir = normalize(light_pos - vpoint_mv);
+    vec3 view_dir = normalize(position3D - vpoint_mv);
+
+    vec4 material = texelFetch(albedo, coord, 0);
+    int k_bits = int(material.a * 255.0 + 0.5);
+    vec3 Ka = material.rgb;
+    vec3 Kd = vec3(float(k_bits / 16) / 15.0 * materialKMax);
+    vec3 Ks = vec3(float(k_bits % 16) / 15.0 * materialKMax);
+    vec3 normal_mv = decodeNormal(texelFetch(normals, coord, 0).rg);
+    vec3 r = normalize(2*normal_mv*(max(0.0f, dot(normal_mv,light_dir))) - light_dir);
+
+    vec3 ambiant = Ka * La;
+    vec3 diffuse = Kd * (max(0.0f, dot(normal_mv, light_dir))) * Ld;
+    vec3 specular = Ks * pow((max(0.0f, dot(r, view_dir))), default_alpha) * Ls;
+
+    color = ambiant + diffuse + specular;
+    gl_FragDepth = z;
+}
@@ -1,13 +1,20 @@
 #pragma once
 #include "icg_helper.h"
 
+// the framebuffer standing for the screen: 0, unless rendering offscreen
+inline GLuint& ScreenFramebuffer() {
+    static GLuint framebuffer_object_id = 0;
+    return framebuffer_object_id;
+}
+
 class FrameBuffer {
 
     private:
         int width_;
         int height_;
         GLuint framebuffer_object_id_;
-        GLuint depth_render_buffer_id_;
+        GLuint depth_render_buffer_id_ = 0;
+        GLuint depth_texture_id_ = 0;
         GLuint color_texture_id_;
 
     public:
@@ -20,10 +27,11 @@ class FrameBuffer {
         }
 
         void Unbind() {
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
         }
 
-        int Init(int image_width, int image_height, bool use_interpolation = false, GLenum format = GL_RED, GLenum int_format = GL_R32F) {
+        int Init(int image_width, int image_height, bool use_interpolation = false, GLenum format = GL_RED, GLenum int_format = GL_R32F,
+                 bool use_depth_texture = false) {
             this->width_ = image_width;
             this->height_ = image_height;
 
@@ -47,8 +55,19 @@ class FrameBuffer {
                 // how to load from buffer
             }
 
-            // create render buffer (for depth channel)
-            {
+            // create render buffer (for depth channel), or a texture when
+            // the depth has to be sampled afterwards
+            if(use_depth_texture) {
+                glGenTextures(1, &depth_texture_id_);
+                glBindTexture(GL_TEXTURE_2D, depth_texture_id_);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width_, height_, 0,
+                             GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            } else {
                 glGenRenderbuffers(1, &depth_render_buffer_id_);
                 glBindRenderbuffer(GL_RENDERBUFFER, depth_render_buffer_id_);
                 glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32, width_, height_);
@@ -63,21 +82,37 @@ class FrameBuffer {
                                        GL_COLOR_ATTACHMENT0 /*location = 0*/,
                                        GL_TEXTURE_2D, color_texture_id_,
                                        0 /*level*/);
-                glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                                          GL_RENDERBUFFER, depth_render_buffer_id_);
+                if(use_depth_texture) {
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                           GL_TEXTURE_2D, depth_texture_id_, 0 /*level*/);
+                } else {
+                    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                              GL_RENDERBUFFER, depth_render_buffer_id_);
+                }
 
                 if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
                     GL_FRAMEBUFFER_COMPLETE) {
                     cerr << "!!!ERROR: Framebuffer not OK :(" << endl;
                 }
-                glBindFramebuffer(GL_FRAMEBUFFER, 0); // avoid pollution
+                glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer()); // avoid pollution
             }
 
             return color_texture_id_;
         }
 
+        // only valid when initialized with use_depth_texture
+        GLuint DepthTexture() {
+            return depth_texture_id_;
+        }
+
+        // e.g. to read the color attachment back
+        GLuint Framebuffer() {
+            return framebuffer_object_id_;
+        }
+
         void Cleanup() {
             glDeleteTextures(1, &color_texture_id_);
+            glDeleteTextures(1, &depth_texture_id_);
             glDeleteRenderbuffers(1, &depth_render_buffer_id_);
             glBindFramebuffer(GL_FRAMEBUFFER, 0 /*UNBIND*/);
             glDeleteFramebuffers(1, &framebuffer_object_id_);
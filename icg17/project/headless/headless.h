@@ -0,0 +1,130 @@
+#pragma once
+#include "icg_helper.h"
+#include "../framebuffer/framebuffer.h"
+
+#ifdef WITH_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// An OpenGL 3.3 core context without any window or display server, through
+// EGL's surfaceless platform (Mesa, including llvmpipe on machines without a
+// GPU). Frames are rendered into an offscreen framebuffer that stands for the
+// screen, see ScreenFramebuffer().
+class HeadlessContext {
+
+    private:
+        EGLDisplay display_ = EGL_NO_DISPLAY;
+        EGLContext context_ = EGL_NO_CONTEXT;
+        GLuint framebuffer_object_id_ = 0;
+        GLuint color_render_buffer_id_ = 0;
+        GLuint depth_render_buffer_id_ = 0;
+        int width_;
+        int height_;
+
+        bool Fail(const char* what) {
+            cerr << "headless: " << what << " failed (EGL error 0x" << hex
+                 << eglGetError() << dec << ")" << endl;
+            return false;
+        }
+
+    public:
+        // creates the context and makes it current, GLEW has to be initialized
+        // afterwards, then InitFramebuffer() called
+        bool Init() {
+            PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if(get_platform_display) {
+                display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                                EGL_DEFAULT_DISPLAY, NULL);
+            }
+            if(display_ == EGL_NO_DISPLAY) {
+                display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            }
+            EGLint major, minor;
+            if(display_ == EGL_NO_DISPLAY || !eglInitialize(display_, &major, &minor)) {
+                return Fail("eglInitialize");
+            }
+            if(!eglBindAPI(EGL_OPENGL_API)) {
+                return Fail("eglBindAPI");
+            }
+
+            const EGLint config_attributes[] = {
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_SURFACE_TYPE, 0,
+                EGL_NONE };
+            EGLConfig config;
+            EGLint num_configs = 0;
+            if(!eglChooseConfig(display_, config_attributes, &config, 1, &num_configs) ||
+               num_configs == 0) {
+                return Fail("eglChooseConfig");
+            }
+
+            const EGLint context_attributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 3,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE };
+            context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, context_attributes);
+            if(context_ == EGL_NO_CONTEXT) {
+                return Fail("eglCreateContext");
+            }
+            if(!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+                return Fail("eglMakeCurrent (surfaceless)");
+            }
+            return true;
+        }
+
+        // the offscreen "screen", left bound
+        void InitFramebuffer(int width, int height) {
+            this->width_ = width;
+            this->height_ = height;
+
+            glGenRenderbuffers(1, &color_render_buffer_id_);
+            glBindRenderbuffer(GL_RENDERBUFFER, color_render_buffer_id_);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+            glGenRenderbuffers(1, &depth_render_buffer_id_);
+            glBindRenderbuffer(GL_RENDERBUFFER, depth_render_buffer_id_);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+            glGenFramebuffers(1, &framebuffer_object_id_);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_object_id_);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                      GL_RENDERBUFFER, color_render_buffer_id_);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                      GL_RENDERBUFFER, depth_render_buffer_id_);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                cerr << "!!!ERROR: Framebuffer not OK :(" << endl;
+            }
+            ScreenFramebuffer() = framebuffer_object_id_;
+        }
+
+        void Cleanup() {
+            ScreenFramebuffer() = 0;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &framebuffer_object_id_);
+            glDeleteRenderbuffers(1, &color_render_buffer_id_);
+            glDeleteRenderbuffers(1, &depth_render_buffer_id_);
+            if(display_ != EGL_NO_DISPLAY) {
+                eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                if(context_ != EGL_NO_CONTEXT) {
+                    eglDestroyContext(display_, context_);
+                }
+                eglTerminate(display_);
+            }
+        }
+
+        // waits for the frame to be rendered, the equivalent of swapping buffers
+        void Finish() {
+            glFinish();
+        }
+
+        // RGB rows of the last frame, bottom row first
+        void ReadPixels(vector<unsigned char> &pixels) {
+            pixels.resize(size_t(width_) * height_ * 3);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_object_id_);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width_, height_, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+        }
+};
+#endif
@@ -0,0 +1,366 @@
+#pragma once
+#include "icg_helper.h"
+#include <cassert>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HEIGHTFIELD_SSE
+#endif
+
+using namespace glm;
+
+// The CPU copy of the heightmap, for everything that needs the terrain height
+// outside of the shaders: camera collision, picking, culling.
+// Positions are in model space like the terrain grid, x and z from -1 to 1
+// over the whole heightmap, y the height. Texel (i, j) sits at the center of
+// its texture cell, as when the shaders sample the heightmap.
+// Ray casts walk a min/max pyramid: level 0 bounds the bilinear patch between
+// 4 neighbouring texels, every level above bounds 2x2 nodes of the one below,
+// so whole regions the ray passes over are skipped at once.
+class HeightField {
+
+    private:
+        struct Level {
+            int width;
+            int height;
+            vector<float> min;
+            vector<float> max;
+        };
+
+        int width_ = 0;
+        int height_ = 0;
+        vector<float> heights_;         // width_ x height_, row (z) after row
+        vector<Level> levels_;          // levels_[0] has one node per patch
+
+        float Texel(int i, int j) const {
+            i = std::min(std::max(i, 0), width_ - 1);
+            j = std::min(std::max(j, 0), height_ - 1);
+            return heights_[j * width_ + i];
+        }
+
+        // model space -> texel space, texel centers on integers
+        float TexelX(float x) const {
+            return (x + 1.0f) * 0.5f * width_ - 0.5f;
+        }
+
+        float TexelZ(float z) const {
+            return (z + 1.0f) * 0.5f * height_ - 0.5f;
+        }
+
+        float Bilinear(float u, float v) const {
+            u = std::min(std::max(u, 0.0f), float(width_ - 1));
+            v = std::min(std::max(v, 0.0f), float(height_ - 1));
+            int i = std::min(int(u), width_ - 2);
+            int j = std::min(int(v), height_ - 2);
+            float fu = u - i;
+            float fv = v - j;
+            const float* row = &heights_[j * width_ + i];
+            float bottom = row[0] + (row[1] - row[0]) * fu;
+            float top = row[width_] + (row[width_ + 1] - row[width_]) * fu;
+            return bottom + (top - bottom) * fv;
+        }
+
+        // cubic through p1 and p2 with Catmull-Rom tangents
+        static float Cubic(float p0, float p1, float p2, float p3, float t) {
+            return p1 + 0.5f * t * (p2 - p0 + t * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 +
+                                                  t * (3.0f * (p1 - p2) + p3 - p0)));
+        }
+
+        void AllocatePyramid() {
+            levels_.clear();
+            Level level;
+            level.width = width_ - 1;
+            level.height = height_ - 1;
+            while (true) {
+                level.min.resize(level.width * level.height);
+                level.max.resize(level.width * level.height);
+                levels_.push_back(level);
+                if (level.width == 1 && level.height == 1) {
+                    break;
+                }
+                level.width = (level.width + 1) / 2;
+                level.height = (level.height + 1) / 2;
+            }
+        }
+
+        // recomputes the patches (i0, j0) to (i1, j1) included, and the nodes
+        // above them
+        void UpdatePyramid(int i0, int j0, int i1, int j1) {
+            Level &base = levels_[0];
+            i0 = std::max(i0, 0);
+            j0 = std::max(j0, 0);
+            i1 = std::min(i1, base.width - 1);
+            j1 = std::min(j1, base.height - 1);
+            for (int j = j0; j <= j1; j++) {
+                for (int i = i0; i <= i1; i++) {
+                    const float* row = &heights_[j * width_ + i];
+                    float a = row[0], b = row[1], c = row[width_], d = row[width_ + 1];
+                    base.min[j * base.width + i] = std::min(std::min(a, b), std::min(c, d));
+                    base.max[j * base.width + i] = std::max(std::max(a, b), std::max(c, d));
+                }
+            }
+
+            for (size_t l = 1; l < levels_.size(); l++) {
+                const Level &below = levels_[l - 1];
+                Level &level = levels_[l];
+                i0 /= 2;
+                j0 /= 2;
+                i1 /= 2;
+                j1 /= 2;
+                for (int j = j0; j <= j1; j++) {
+                    for (int i = i0; i <= i1; i++) {
+                        float low = FLT_MAX, high = -FLT_MAX;
+                        for (int cj = 2 * j; cj < std::min(2 * j + 2, below.height); cj++) {
+                            for (int ci = 2 * i; ci < std::min(2 * i + 2, below.width); ci++) {
+                                low = std::min(low, below.min[cj * below.width + ci]);
+                                high = std::max(high, below.max[cj * below.width + ci]);
+                            }
+                        }
+                        level.min[j * level.width + i] = low;
+                        level.max[j * level.width + i] = high;
+                    }
+                }
+            }
+        }
+
+        // entry and exit of the ray (texel space x/z, model space y) through
+        // a box, clipped to [t0, t1], false if it misses
+        static bool Slab(const vec3 &origin, const vec3 &inverse, const vec3 &low,
+                         const vec3 &high, float &t0, float &t1) {
+            for (int axis = 0; axis < 3; axis++) {
+                float near = (low[axis] - origin[axis]) * inverse[axis];
+                float far = (high[axis] - origin[axis]) * inverse[axis];
+                if (near > far) {
+                    std::swap(near, far);
+                }
+                // NaN (parallel ray on the slab boundary) keeps the bounds
+                t0 = near > t0 ? near : t0;
+                t1 = far < t1 ? far : t1;
+            }
+            return t0 <= t1;
+        }
+
+        // first hit in node (i, j) of 'level' between t0 and t1
+        bool Cast(const vec3 &origin, const vec3 &direction, const vec3 &inverse, int level,
+                  int i, int j, float t0, float t1, float &hit) const {
+            const Level &nodes = levels_[level];
+            if (i >= nodes.width || j >= nodes.height) {
+                return false;
+            }
+            int size = 1 << level;
+            vec3 low(float(i * size), nodes.min[j * nodes.width + i], float(j * size));
+            vec3 high(float((i + 1) * size), nodes.max[j * nodes.width + i], float((j + 1) * size));
+            if (!Slab(origin, inverse, low, high, t0, t1)) {
+                return false;
+            }
+
+            if (level == 0) {
+                // the patch is bilinear: march it, then refine the crossing
+                const int STEPS = 4;
+                float previous_t = t0;
+                vec3 p = origin + t0 * direction;
+                if (p.y <= Bilinear(p.x, p.z)) {
+                    hit = t0;
+                    return true;
+                }
+                for (int step = 1; step <= STEPS; step++) {
+                    float t = t0 + (t1 - t0) * step / STEPS;
+                    p = origin + t * direction;
+                    if (p.y <= Bilinear(p.x, p.z)) {
+                        float above = previous_t, below = t;
+                        for (int k = 0; k < 10; k++) {
+                            float middle = 0.5f * (above + below);
+                            vec3 q = origin + middle * direction;
+                            (q.y <= Bilinear(q.x, q.z) ? below : above) = middle;
+                        }
+                        hit = below;
+                        return true;
+                    }
+                    previous_t = t;
+                }
+                return false;
+            }
+
+            // children nearest first
+            float entries[4];
+            int order[4];
+            int count = 0;
+            for (int child = 0; child < 4; child++) {
+                int ci = 2 * i + (child & 1), cj = 2 * j + (child >> 1);
+                const Level &below = levels_[level - 1];
+                if (ci >= below.width || cj >= below.height) {
+                    continue;
+                }
+                int child_size = size / 2;
+                float c0 = t0, c1 = t1;
+                vec3 child_low(float(ci * child_size), below.min[cj * below.width + ci],
+                               float(cj * child_size));
+                vec3 child_high(float((ci + 1) * child_size), below.max[cj * below.width + ci],
+                                float((cj + 1) * child_size));
+                if (Slab(origin, inverse, child_low, child_high, c0, c1)) {
+                    int k = count++;
+                    while (k > 0 && entries[k - 1] > c0) {
+                        entries[k] = entries[k - 1];
+                        order[k] = order[k - 1];
+                        k--;
+                    }
+                    entries[k] = c0;
+                    order[k] = child;
+                }
+            }
+            for (int k = 0; k < count; k++) {
+                int child = order[k];
+                if (Cast(origin, direction, inverse, level - 1, 2 * i + (child & 1),
+                         2 * j + (child >> 1), t0, t1, hit)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        // copies 'heights', 'width' x 'height' floats, row after row
+        void Init(int width, int height, const float* heights) {
+            if (width < 2 || height < 2) {
+                throw(string("A height field needs at least 2x2 texels"));
+            }
+            width_ = width;
+            height_ = height;
+            heights_.assign(heights, heights + size_t(width) * height);
+            AllocatePyramid();
+            UpdatePyramid(0, 0, width_ - 2, height_ - 2);
+        }
+
+        // replaces the texels (x, y) to (x + w, y + h), e.g. after an edit of
+        // the terrain, 'heights' holds w x h floats row after row
+        void UpdateRegion(int x, int y, int w, int h, const float* heights) {
+            if (x < 0 || y < 0 || x + w > width_ || y + h > height_) {
+                throw(string("Height field region out of bounds"));
+            }
+            for (int j = 0; j < h; j++) {
+                std::copy(heights + j * w, heights + (j + 1) * w,
+                          heights_.begin() + (y + j) * width_ + x);
+            }
+            // the patches on the border of the region use its texels too
+            UpdatePyramid(x - 1, y - 1, x + w - 1, y + h - 1);
+        }
+
+        bool Empty() const {
+            return heights_.empty();
+        }
+
+        // bilinear height at (x, z), clamped to the border of the terrain
+        float Height(float x, float z) const {
+            return Bilinear(TexelX(x), TexelZ(z));
+        }
+
+        // smoother but 4x the texel reads, for slopes the camera glides on
+        float HeightBicubic(float x, float z) const {
+            float u = std::min(std::max(TexelX(x), 0.0f), float(width_ - 1));
+            float v = std::min(std::max(TexelZ(z), 0.0f), float(height_ - 1));
+            int i = int(floor(u));
+            int j = int(floor(v));
+            float fu = u - i;
+            float fv = v - j;
+            float rows[4];
+            for (int k = 0; k < 4; k++) {
+                int row = j - 1 + k;
+                rows[k] = Cubic(Texel(i - 1, row), Texel(i, row), Texel(i + 1, row),
+                                Texel(i + 2, row), fu);
+            }
+            return Cubic(rows[0], rows[1], rows[2], rows[3], fv);
+        }
+
+        // bilinear heights of 'count' points at once, the same as Height()
+        void Heights(const float* x, const float* z, float* heights, int count) const {
+            int first = 0;
+#ifdef HEIGHTFIELD_SSE
+            const __m128 scale_u = _mm_set1_ps(0.5f * width_);
+            const __m128 scale_v = _mm_set1_ps(0.5f * height_);
+            const __m128 offset_u = _mm_set1_ps(0.5f * width_ - 0.5f);
+            const __m128 offset_v = _mm_set1_ps(0.5f * height_ - 0.5f);
+            const __m128 max_u = _mm_set1_ps(float(width_ - 1));
+            const __m128 max_v = _mm_set1_ps(float(height_ - 1));
+            const __m128i last_i = _mm_set1_epi32(width_ - 2);
+            const __m128i last_j = _mm_set1_epi32(height_ - 2);
+            const __m128 zero = _mm_setzero_ps();
+            for (; first + 4 <= count; first += 4) {
+                __m128 u = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + first), scale_u), offset_u);
+                __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z + first), scale_v), offset_v);
+                u = _mm_min_ps(_mm_max_ps(u, zero), max_u);
+                v = _mm_min_ps(_mm_max_ps(v, zero), max_v);
+
+                // truncation is floor for the positive coordinates, the last
+                // texel belongs to the last patch (SSE2 has no integer min)
+                __m128i i = _mm_cvttps_epi32(u);
+                __m128i j = _mm_cvttps_epi32(v);
+                __m128i i_over = _mm_cmpgt_epi32(i, last_i);
+                __m128i j_over = _mm_cmpgt_epi32(j, last_j);
+                i = _mm_or_si128(_mm_andnot_si128(i_over, i), _mm_and_si128(i_over, last_i));
+                j = _mm_or_si128(_mm_andnot_si128(j_over, j), _mm_and_si128(j_over, last_j));
+                __m128 fu = _mm_sub_ps(u, _mm_cvtepi32_ps(i));
+                __m128 fv = _mm_sub_ps(v, _mm_cvtepi32_ps(j));
+
+                // no gather before AVX2
+                int is[4], js[4];
+                _mm_storeu_si128((__m128i*) is, i);
+                _mm_storeu_si128((__m128i*) js, j);
+                float a[4], b[4], c[4], d[4];
+                for (int k = 0; k < 4; k++) {
+                    const float* row = &heights_[js[k] * width_ + is[k]];
+                    a[k] = row[0];
+                    b[k] = row[1];
+                    c[k] = row[width_];
+                    d[k] = row[width_ + 1];
+                }
+                __m128 va = _mm_loadu_ps(a), vb = _mm_loadu_ps(b);
+                __m128 vc = _mm_loadu_ps(c), vd = _mm_loadu_ps(d);
+                __m128 bottom = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), fu));
+                __m128 top = _mm_add_ps(vc, _mm_mul_ps(_mm_sub_ps(vd, vc), fu));
+                _mm_storeu_ps(heights + first,
+                              _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), fv)));
+            }
+#ifndef NDEBUG
+            // debug builds check the vector path against the scalar one
+            for (int k = 0; k < first; k++) {
+                assert(std::abs(heights[k] - Height(x[k], z[k])) < 1e-5f);
+            }
+#endif
+#endif
+            for (int k = first; k < count; k++) {
+                heights[k] = Height(x[k], z[k]);
+            }
+        }
+
+        // first point where the ray hits the terrain within 'max_distance'
+        // (in units of 'direction'), false if it does not
+        bool Raycast(const vec3 &origin, const vec3 &direction, float max_distance,
+                     vec3 &hit) const {
+            if (levels_.empty()) {
+                return false;
+            }
+            // texel space for x and z, the ray parameter stays the same
+            vec3 texel_origin(TexelX(origin.x), origin.y, TexelZ(origin.z));
+            vec3 texel_direction(direction.x * 0.5f * width_, direction.y,
+                                 direction.z * 0.5f * height_);
+            vec3 inverse(1.0f / texel_direction.x, 1.0f / texel_direction.y,
+                         1.0f / texel_direction.z);
+
+            // starting under the terrain, the boxes would all be above the ray
+            if (texel_origin.x >= 0.0f && texel_origin.x <= width_ - 1 &&
+                texel_origin.z >= 0.0f && texel_origin.z <= height_ - 1 &&
+                origin.y <= Bilinear(texel_origin.x, texel_origin.z)) {
+                hit = origin;
+                return true;
+            }
+
+            float t;
+            int top = int(levels_.size()) - 1;
+            if (!Cast(texel_origin, texel_direction, inverse, top, 0, 0, 0.0f, max_distance, t)) {
+                return false;
+            }
+            hit = origin + t * direction;
+            return true;
+        }
+};
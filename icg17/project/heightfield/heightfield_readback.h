@@ -0,0 +1,154 @@
+#pragma once
+#include "icg_helper.h"
+#include "heightfield.h"
+#include "../framebuffer/framebuffer.h"
+#include <deque>
+#include <functional>
+
+// Copies regions of the heightmap framebuffer into a HeightField without
+// stalling: every request reads into its own pixel pack buffer and sets a
+// fence, Update() applies the regions whose fence passed, a few frames later.
+// A region still pending after MAX_FRAMES_PENDING updates (or whose buffer
+// can't be mapped) is regenerated on the CPU instead, if a generator is given.
+class HeightFieldReadback {
+
+    public:
+        // writes the heights of the texels (x, y) to (x + w, y + h), row after row
+        typedef std::function<void(int x, int y, int w, int h, float* heights)> Generator;
+
+    private:
+        static const int MAX_FRAMES_PENDING = 8;
+
+        struct Pending {
+            GLuint buffer_id;
+            GLsync fence;
+            int x, y, w, h;
+            int frames;                 // updates it has been waiting for
+        };
+
+        GLuint framebuffer_id_;
+        int width_;
+        int height_;
+        Generator generator_;
+        std::deque<Pending> pending_;
+        vector<GLuint> free_buffers_;
+        vector<float> scratch_;
+
+        void Apply(HeightField &heightfield, const Pending &region, const float* heights) {
+            if (region.w == width_ && region.h == height_) {
+                heightfield.Init(width_, height_, heights);
+            } else if (!heightfield.Empty()) {
+                heightfield.UpdateRegion(region.x, region.y, region.w, region.h, heights);
+            }
+            // else: a partial region before any full one, nothing to patch
+        }
+
+        // maps the buffer of a region whose fence passed, false if it can't
+        bool ApplyBuffer(HeightField &heightfield, const Pending &region) {
+            GLsizeiptr bytes = GLsizeiptr(region.w) * region.h * sizeof(float);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, region.buffer_id);
+            const float* heights = (const float*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                                                   GL_MAP_READ_BIT);
+            if (heights) {
+                Apply(heightfield, region, heights);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            return heights != NULL;
+        }
+
+        bool Regenerate(HeightField &heightfield, const Pending &region) {
+            if (!generator_) {
+                return false;
+            }
+            scratch_.resize(size_t(region.w) * region.h);
+            generator_(region.x, region.y, region.w, region.h, &scratch_[0]);
+            Apply(heightfield, region, &scratch_[0]);
+            return true;
+        }
+
+    public:
+        // reads the red channel of 'framebuffer_id', a width x height float
+        // target. 'generator' (may be empty) computes the same heights on the CPU.
+        void Init(GLuint framebuffer_id, int width, int height,
+                  const Generator &generator = Generator()) {
+            framebuffer_id_ = framebuffer_id;
+            width_ = width;
+            height_ = height;
+            generator_ = generator;
+        }
+
+        void Cleanup() {
+            for (size_t i = 0; i < pending_.size(); i++) {
+                glDeleteSync(pending_[i].fence);
+                free_buffers_.push_back(pending_[i].buffer_id);
+            }
+            pending_.clear();
+            if (!free_buffers_.empty()) {
+                glDeleteBuffers(GLsizei(free_buffers_.size()), &free_buffers_[0]);
+            }
+            free_buffers_.clear();
+        }
+
+        // queues the texels (x, y) to (x + w, y + h), call once the heightmap
+        // has been drawn
+        void Request(int x, int y, int w, int h) {
+            Pending region = { 0, 0, x, y, w, h, 0 };
+            if (free_buffers_.empty()) {
+                glGenBuffers(1, &region.buffer_id);
+            } else {
+                region.buffer_id = free_buffers_.back();
+                free_buffers_.pop_back();
+            }
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, region.buffer_id);
+            glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(w) * h * sizeof(float), NULL,
+                         GL_STREAM_READ);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_id_);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(x, y, w, h, GL_RED, GL_FLOAT, NULL);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, ScreenFramebuffer());
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // the fence has to reach the GPU for polling it to ever succeed
+            glFlush();
+            pending_.push_back(region);
+        }
+
+        void RequestAll() {
+            Request(0, 0, width_, height_);
+        }
+
+        // applies the regions that arrived, in the order they were requested,
+        // returns how many were handled. never waits on the GPU.
+        int Update(HeightField &heightfield) {
+            int applied = 0;
+            while (!pending_.empty()) {
+                Pending &region = pending_.front();
+                GLenum status = glClientWaitSync(region.fence, 0, 0);
+                bool arrived = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+                if (!arrived && ++region.frames <= MAX_FRAMES_PENDING) {
+                    break;
+                }
+                bool done = arrived && ApplyBuffer(heightfield, region);
+                if (!done) {
+                    done = Regenerate(heightfield, region);
+                }
+                if (!done && !arrived) {
+                    // no generator: the GPU will get there eventually
+                    break;
+                }
+                glDeleteSync(region.fence);
+                free_buffers_.push_back(region.buffer_id);
+                pending_.pop_front();
+                applied++;
+            }
+            return applied;
+        }
+
+        bool Idle() const {
+            return pending_.empty();
+        }
+};
@@ -13,6 +13,79 @@ class HeightMap {
         float offset_ = 0.7f;
         float gain_ = 2.7f;
 
+        // CPU version of heightmap_fshader.glsl, keep the two in sync
+        static const int* Permutations() {
+            static const int permutations[] = {
+                151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36,
+                103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23, 190, 6, 148, 247, 120, 234, 75,
+                0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33, 88, 237, 149,
+                56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27,
+                166, 77, 146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230, 220, 105, 92, 41,
+                55, 46, 245, 40, 244, 102, 143, 54, 65, 25, 63, 161, 1, 216, 80, 73, 209, 76,
+                132, 187, 208, 89, 18, 169, 200, 196, 135, 130, 116, 188, 159, 86, 164, 100,
+                109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123, 5, 202, 38, 147, 118,
+                126, 255, 82, 85, 212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42,
+                223, 183, 170, 213, 119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155,
+                167, 43, 172, 9, 129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178,
+                185, 112, 104, 218, 246, 97, 228, 251, 34, 242, 193, 238, 210, 144, 12, 191,
+                179, 162, 241, 81, 51, 145, 235, 249, 14, 239, 107, 49, 192, 214, 31, 181, 199,
+                106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254, 138, 236, 205,
+                93, 222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180 };
+            return permutations;
+        }
+
+        // GLSL's mod(), never negative
+        static float Mod(float x, float y) {
+            return x - y * floor(x / y);
+        }
+
+        static int Permutation(float index) {
+            return Permutations()[int(Mod(float(int(index)), 255.0f))];
+        }
+
+        static float Gradient(int index, float x, float y) {
+            static const float gradients[8][2] = { { 1.0f,  1.0f }, { -1.0f,  1.0f },
+                                                   { 1.0f, -1.0f }, { -1.0f, -1.0f },
+                                                   { 0.0f,  1.0f }, {  0.0f, -1.0f },
+                                                   { 1.0f,  0.0f }, { -1.0f,  0.0f } };
+            const float* gradient = gradients[int(Mod(float(index), 8.0f))];
+            return gradient[0] * x + gradient[1] * y;
+        }
+
+        static float PerlinNoise(float x, float y) {
+            float cell_x = floor(x), cell_y = floor(y);
+            float px = x - cell_x, py = y - cell_y;
+
+            float bl = Gradient(Permutation(Permutation(cell_x) + cell_y), px, py);
+            float br = Gradient(Permutation(Permutation(cell_x + 1) + cell_y), px - 1, py);
+            float tl = Gradient(Permutation(Permutation(cell_x) + cell_y + 1), px, py - 1);
+            float tr = Gradient(Permutation(Permutation(cell_x + 1) + cell_y + 1), px - 1, py - 1);
+
+            float fx = px * px * px * (px * (px * 6 - 15) + 10);
+            float fy = py * py * py * (py * (py * 6 - 15) + 10);
+            float bottom = bl + fx * (br - bl);
+            float top = tl + fx * (tr - tl);
+            return bottom + fy * (top - bottom);
+        }
+
+        float RidgedMultifractal(float x, float y) const {
+            float frequency = 0.9f;
+            float sgnl = offset_ - std::abs(PerlinNoise(x, y));
+            sgnl *= sgnl;
+            float result = sgnl;
+
+            for (int i = 1; i < octaves_; ++i) {
+                x *= lacunarity_;
+                y *= lacunarity_;
+                float weight = std::min(std::max(sgnl * gain_, 0.0f), 1.0f);
+                sgnl = offset_ - std::abs(PerlinNoise(x, y));
+                sgnl *= sgnl * weight;
+                result += sgnl * pow(frequency, -H_id_);
+                frequency *= lacunarity_;
+            }
+            return result;
+        }
+
     public:
         void Init() {
             // compile the shaders
@@ -105,6 +178,20 @@ class HeightMap {
             glUseProgram(0);
         }
 
+        // what Draw() renders into a 'width' x 'height' target, computed on the
+        // CPU for the texels (x, y) to (x + w, y + h), row after row
+        void Generate(int width, int height, int x, int y, int w, int h,
+                      float* heights) const {
+            const float height_scale_factor = 0.2f;
+            for (int j = 0; j < h; j++) {
+                for (int i = 0; i < w; i++) {
+                    float u = (x + i + 0.5f) / width;
+                    float v = (y + j + 0.5f) / height;
+                    heights[j * w + i] = RidgedMultifractal(u, v) * height_scale_factor;
+                }
+            }
+        }
+
         void setH(float increment) {
             H_id_ += increment;
             cout << "Changing H" << H_id_ << endl;
@@ -5,42 +5,115 @@
 #include "icg_helper.h"
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <mutex>
 
 #include "terrain/terrain.h"
 
 #include "trackball.h"
 #include "framebuffer/framebuffer.h"
 #include "heightmap/heightmap.h"
+#include "splatmap/splatmap.h"
 #include "skybox/skybox.h"
 #include "camera/camera.h"
+#include "camera/camera_path.h"
+#include "heightfield/heightfield.h"
+#include "heightfield/heightfield_readback.h"
+#include "simulation/fixed_timestep.h"
+#include "threading/triple_buffer.h"
+#include "threading/job_system.h"
 #include "waveheightmap/waveheightmap.h"
 #include "wavenormalmap/wavenormalmap.h"
-
-void applyCameraMovements();
+#include "reflectioncache/reflectioncache.h"
+#include "ssr/ssr.h"
+#include "deferred/deferred.h"
+#include "profiler/profiler.h"
+#include "profiler/overlay.h"
+#include "assets/asset_manager.h"
+#include "uniforms/uniform_buffer.h"
+#include "renderstate/renderstate.h"
+#include "headless/headless.h"
+#include "texture/png_writer.h"
+#include "benchmark/benchmark.h"
+
+void applyCameraMovements(float dt);
 void handleFactors();
 void handleKeys();
-
-GLFWwindow* window;
+glm::mat4 MirrorMatrix();
+glm::ivec4 WaterScissor(const glm::mat4 &mvp);
+void ReportFrameCost(float time);
+void UpdateHeightField();
+void DumpProfile();
+void ToggleRecording();
+void ReplayCamera(float time);
+void GenerateTerrain();
+void Cleanup();
+
+// planar: the terrain is rendered a second time into the mirror texture.
+// screen space: the water ray-marches the depth of the scene, only the sky is
+// rendered into the mirror, as a fallback for rays that miss.
+enum ReflectionMode { PLANAR_REFLECTION, SCREEN_SPACE_REFLECTION };
+
+GLFWwindow* window = NULL;      // stays NULL with --headless
 
 Terrain terrain;
 FrameBuffer framebuffer_height;
+FrameBuffer framebuffer_splat;
 FrameBuffer framebuffer_mirror;
 FrameBuffer framebuffer_waveheight;
 FrameBuffer framebuffer_wavenormal;
 
 HeightMap heightmap;
+HeightField heightfield;        // CPU copy of the heightmap, for the camera
+HeightField readback_heightfield;   // the render thread's, copied to heightfield
+std::mutex heightfield_mutex;   // guards heightfield
+HeightFieldReadback heightfield_readback;
+SplatMap splatmap;
 Terrain water;
 Terrain reflection;
 Skybox skybox;
 Skybox skybox_mirror;
 WaveheightMap waveheightmap;
 WavenormalMap wavenormalmap;
+ReflectionCache reflection_cache;
+ScreenSpaceReflection ssr;
+DeferredShading deferred;
+ReflectionMode reflection_mode = PLANAR_REFLECTION;
+Profiler profiler;
+ProfilerOverlay profiler_overlay;
+bool show_profiler = false;
+unsigned profile_dumps = 0;     // J presses, the render thread writes the profile
+bool depth_prepass = true;      // the terrain lays its depth down before shading
+bool deferred_shading = false;  // the terrain fills a G-buffer, lit in one pass
+bool procedural_grid = true;    // the terrain grid from gl_VertexID, not from buffers
+int mirror_sky_pass;
+int mirror_terrain_pass;
+int depth_prepass_pass;
+int terrain_pass;
+int skybox_pass;
+int hiz_pass;
+int lighting_pass;
+int water_pass;
+float last_report_time = 0.0f;
+FixedTimestep simulation;       // input and camera, 60 steps per second
+int swap_interval = 1;          // vsync: 1 on, 0 off, -1 adaptive
+JobSystem jobs;                 // CPU work of the engine, spread over the cores
+AssetManager assets;
+UniformBuffer frame_uniforms;
+UniformBuffer light_uniforms;
 Trackball trackball;
 Camera camera;
+CameraPath camera_path;
+bool recording = false;         // adds the camera of every frame to camera_path
+bool replaying = false;         // the camera follows camera_path instead of the keys
+string recording_file = "flight.campath";
 
 vec3 cam_look;
 vec3 cam_pos;
 vec3 cam_up;
+// the camera one simulation step earlier, frames interpolate from it
+vec3 previous_cam_look;
+vec3 previous_cam_pos;
+vec3 previous_cam_up;
 
 using namespace glm;
 
@@ -50,6 +123,36 @@ mat4 trackball_matrix;
 mat4 old_trackball_matrix;
 mat4 quad_model_matrix;
 
+// what a frame is rendered from. the main thread polls the events, runs the
+// simulation and publishes one of these after every step, the render thread
+// draws the latest one, while the next is being simulated.
+struct FrameSnapshot {
+    double time;                // clock time of the simulation step
+    vec3 previous_pos;          // the camera one step earlier, frames
+    vec3 previous_look;         // interpolate from it
+    vec3 previous_up;
+    vec3 pos;
+    vec3 look;
+    vec3 up;
+    mat4 projection;
+    mat4 model;                 // trackball
+    int width;
+    int height;
+    ivec4 water_rect;           // screen part the water covers, in both cameras
+    ReflectionMode reflection_mode;
+    bool show_profiler;
+    unsigned profile_dumps;
+    bool depth_prepass;
+    bool deferred_shading;
+};
+
+TripleBuffer<FrameSnapshot> snapshots;  // main thread -> render thread
+TripleBuffer<string> window_title;      // render thread -> main thread
+FrameSnapshot last_frame;               // the frame rendered before
+std::atomic<bool> rendering(false);     // the render thread runs while set
+
+void TakeSnapshot(FrameSnapshot &frame, double time);
+
 int window_width = 1200;
 int window_height = 1000;
 
@@ -63,8 +166,6 @@ float eps = 0.0005;
 float decelWS = 0.5;
 float decelAD = 0.8;
 float decelQE = 0.8;
-float fps_quantum;
-int fps_count = 0;
 
 void Init(GLFWwindow* window) {
     // sets background color
@@ -77,6 +178,9 @@ void Init(GLFWwindow* window) {
     cam_pos = vec3(0.5f, 0.130f, 0.5f);
     cam_look = vec3(0.0f, 0.0f, 0.0f);
     cam_up = vec3(0.0f, 1.0f, 0.0f);
+    previous_cam_pos = cam_pos;
+    previous_cam_look = cam_look;
+    previous_cam_up = cam_up;
     view_matrix = lookAt(cam_pos, cam_look, cam_up);
     float ratio = window_width / (float) window_height;
     projection_matrix = perspective(45.0f, ratio, 0.01f, 100.0f);
@@ -86,21 +190,41 @@ void Init(GLFWwindow* window) {
     // on retina/hidpi displays, pixels != screen coordinates
     // this unsures that the framebuffer has the same size as the window
     // (see http://www.glfw.org/docs/latest/window.html#window_fbsize)
-    glfwGetFramebufferSize(window, &window_width, &window_height);
+    if (window) {
+        glfwGetFramebufferSize(window, &window_width, &window_height);
+    }
     int framebuffer_height_id = framebuffer_height.Init(window_width, window_height, true);
+    int framebuffer_splat_id = framebuffer_splat.Init(window_width, window_height, true, GL_RGBA, GL_RGBA8);
     int framebuffer_waveheight_id = framebuffer_waveheight.Init(water_texture_size, water_texture_size, true, GL_RGB, GL_RGB12);
     int framebuffer_wavenormal_id = framebuffer_wavenormal.Init(water_texture_size, water_texture_size, true, GL_RGB, GL_RGB12);
     int framebuffer_mirror_id = framebuffer_mirror.Init(window_width, window_height, true, GL_RGB, GL_RGB32F);
 
     int fps = 60;
 
-    heightmap.Init();
+    jobs.Init();
+    assets.Init(jobs);
 
-    // Generate a height map
-    framebuffer_height.Bind();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        heightmap.Draw();
-    framebuffer_height.Unbind();
+    // the light never changes, the frame block is written by Display()
+    LightUniforms light;
+    light_uniforms.Init(LIGHT_UNIFORMS_BINDING, sizeof(LightUniforms), &light, GL_STATIC_DRAW);
+    frame_uniforms.Init(FRAME_UNIFORMS_BINDING, sizeof(FrameUniforms));
+
+    heightmap.Init();
+    splatmap.Init(framebuffer_height_id, window_width, window_height);
+    // the window may be resized while the render thread regenerates heights
+    int map_width = window_width;
+    int map_height = window_height;
+    heightfield_readback.Init(framebuffer_height.Framebuffer(), window_width, window_height,
+                              [map_width, map_height](int x, int y, int w, int h,
+                                                      float* heights) {
+                                  // a few rows per job
+                                  jobs.ParallelFor(y, y + h, 16, [&](int begin, int end) {
+                                      heightmap.Generate(map_width, map_height, x, begin,
+                                                         w, end - begin,
+                                                         heights + (begin - y) * w);
+                                  });
+                              });
+    GenerateTerrain();
 
     waveheightmap.Init(framebuffer_height_id, fps);
     wavenormalmap.Init(framebuffer_height_id, fps);
@@ -118,63 +242,347 @@ void Init(GLFWwindow* window) {
     framebuffer_waveheight.Unbind();
 
     terrain.Init(window_width, window_height, framebuffer_height_id,
+                                              framebuffer_splat_id,
                                               framebuffer_mirror_id,
                                               framebuffer_waveheight_id,
                                               framebuffer_wavenormal_id,
                                               false,
                                               false,
-                                              fps);
+                                              fps,
+                                              assets,
+                                              jobs,
+                                              procedural_grid);
     reflection.Init(window_width, window_height, framebuffer_height_id,
+                                              framebuffer_splat_id,
                                               framebuffer_mirror_id,
                                               framebuffer_waveheight_id,
                                               framebuffer_wavenormal_id,
                                               false,
                                               true,
-                                              fps);
+                                              fps,
+                                              assets,
+                                              jobs,
+                                              procedural_grid);
     water.Init(window_width, window_height, framebuffer_height_id,
+                                              framebuffer_splat_id,
                                               framebuffer_mirror_id,
                                               framebuffer_waveheight_id,
                                               framebuffer_wavenormal_id,
                                               true,
                                               false,
-                                              fps);
-    skybox.Init();
-    skybox_mirror.Init(true);
-    camera.Init(window_width, window_height, framebuffer_height_id);
-
-    fps_quantum = 1.0f/60;
-    fps_count = 0;
+                                              fps,
+                                              assets,
+                                              jobs,
+                                              procedural_grid);
+    skybox.Init(assets);
+    skybox_mirror.Init(assets);
+    camera.Init(heightfield);
+    reflection_cache.Init(WATER_LEVEL);
+    ssr.Init(window_width, window_height);
+    deferred.Init(window_width, window_height);
+    profiler.Init();
+    profiler_overlay.Init();
+    mirror_sky_pass = profiler.AddPass("mirror sky");
+    mirror_terrain_pass = profiler.AddPass("mirror terrain");
+    depth_prepass_pass = profiler.AddPass("depth pre-pass");
+    terrain_pass = profiler.AddPass("terrain");
+    lighting_pass = profiler.AddPass("lighting");
+    skybox_pass = profiler.AddPass("skybox");
+    hiz_pass = profiler.AddPass("hi-z");
+    water_pass = profiler.AddPass("water");
+    TakeSnapshot(last_frame, 0.0);
+
+    // the initialization bound whatever it needed
+    GlState().Invalidate();
 }
 
-// gets called for every frame.
-void Display() {
-    const float time = glfwGetTime();
+// generates the height map, and the material weights that go with it. to be
+// called again whenever the height map parameters change.
+void GenerateTerrain() {
+    framebuffer_height.Bind();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        heightmap.Draw();
+    framebuffer_height.Unbind();
 
-    int fps_curr = int(fmod(time, 1.0f)/fps_quantum);
+    framebuffer_splat.Bind();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        splatmap.Draw();
+    framebuffer_splat.Unbind();
+
+    // the camera gets the new heights a few frames later
+    heightfield_readback.RequestAll();
 
-    //if(fps_curr != fps_count){
-    //    fps_count = fps_curr;
+    // both passes bind their programs directly
+    GlState().Invalidate();
+}
 
+// one step of the simulation, 'dt' seconds long, up to clock time 'time'
+void Simulate(double time, float dt) {
+    previous_cam_pos = cam_pos;
+    previous_cam_look = cam_look;
+    previous_cam_up = cam_up;
+    if (replaying) {
+        ReplayCamera(time);
+    } else {
         handleKeys();
         handleFactors();
-        applyCameraMovements();
+        std::lock_guard<std::mutex> lock(heightfield_mutex);
+        applyCameraMovements(dt);
+    }
+    if (recording) {
+        camera_path.Add(time, cam_pos, cam_look, cam_up);
+    }
+}
 
-        view_matrix = lookAt(cam_pos, cam_look, cam_up);
+// union of two screen rectangles (x, y, width, height), ignoring empty ones
+ivec4 UnionRect(const ivec4 &a, const ivec4 &b) {
+    if (a.z <= 0 || a.w <= 0) {
+        return b;
+    }
+    if (b.z <= 0 || b.w <= 0) {
+        return a;
+    }
+    ivec2 from = min(ivec2(a.x, a.y), ivec2(b.x, b.y));
+    ivec2 to = max(ivec2(a.x + a.z, a.y + a.w), ivec2(b.x + b.z, b.y + b.w));
+    return ivec4(from, to - from);
+}
 
-        glViewport(0, 0, window_width, window_height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// copies the state of the simulation at clock time 'time' into 'frame'
+void TakeSnapshot(FrameSnapshot &frame, double time) {
+    frame.time = time;
+    frame.previous_pos = previous_cam_pos;
+    frame.previous_look = previous_cam_look;
+    frame.previous_up = previous_cam_up;
+    frame.pos = cam_pos;
+    frame.look = cam_look;
+    frame.up = cam_up;
+    frame.projection = projection_matrix;
+    frame.model = trackball_matrix * quad_model_matrix;
+    frame.width = window_width;
+    frame.height = window_height;
+    frame.reflection_mode = reflection_mode;
+    frame.show_profiler = show_profiler;
+    frame.profile_dumps = profile_dumps;
+    frame.depth_prepass = depth_prepass;
+    frame.deferred_shading = deferred_shading;
+
+    // the water seen by any camera interpolated between the two, the margin
+    // of the scissor covers the little distance between them
+    mat4 previous_view = lookAt(previous_cam_pos, previous_cam_look, previous_cam_up);
+    mat4 view = lookAt(cam_pos, cam_look, cam_up);
+    frame.water_rect = UnionRect(WaterScissor(frame.projection * previous_view * frame.model),
+                                 WaterScissor(frame.projection * view * frame.model));
+}
+
+// renders 'frame', 'time' drives the waves. the camera is drawn 'alpha' of
+// the way from its previous simulation step to the last one.
+void Display(const FrameSnapshot &frame, float time, float alpha = 1.0f) {
+    profiler.BeginFrame();
+    UpdateHeightField();
 
+    // the mirror was rendered for another mode or size
+    if (frame.reflection_mode != last_frame.reflection_mode ||
+        frame.width != last_frame.width || frame.height != last_frame.height) {
+        reflection_cache.Invalidate();
+    }
+    if (frame.profile_dumps != last_frame.profile_dumps) {
+        DumpProfile();
+    }
+    last_frame = frame;
+
+    mat4 view = lookAt(mix(frame.previous_pos, frame.pos, alpha),
+                       mix(frame.previous_look, frame.look, alpha),
+                       mix(frame.previous_up, frame.up, alpha));
+
+    // shared by every pass of the frame
+    FrameUniforms uniforms;
+    uniforms.view = view;
+    uniforms.projection = frame.projection;
+    uniforms.time = time;
+    frame_uniforms.Update(&uniforms);
+
+    glViewport(0, 0, frame.width, frame.height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // only the part of the mirror covered by the water is ever sampled,
+    // and it is reused as long as the camera barely moved
+    mat4 model_matrix = frame.model;
+    mat4 mvp = frame.projection * view * model_matrix;
+    ivec4 water_rect = frame.water_rect;
+    bool use_ssr = frame.reflection_mode == SCREEN_SPACE_REFLECTION;
+    if (water_rect.z > 0 && water_rect.w > 0 &&
+        reflection_cache.NeedsUpdate(mvp, water_rect, frame.width, frame.height)) {
         framebuffer_mirror.Bind();
+            GlState().Enable(GL_SCISSOR_TEST);
+            glScissor(water_rect.x, water_rect.y, water_rect.z, water_rect.w);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            skybox_mirror.Draw(trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
-            reflection.Draw(time, trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
+            if (!use_ssr) {
+                ProfileScope scope(profiler, mirror_terrain_pass);
+                reflection.Draw(time, model_matrix * MirrorMatrix());
+            }
+            {
+                ProfileScope scope(profiler, mirror_sky_pass);
+                skybox_mirror.Draw(model_matrix * MirrorMatrix());
+            }
+            GlState().Disable(GL_SCISSOR_TEST);
         framebuffer_mirror.Unbind();
+        reflection_cache.Update(mvp, water_rect);
+    }
+    water.SetReflectionViewProjection(reflection_cache.ViewProjection());
+
+    // with screen space reflections the opaque scene goes through its own
+    // framebuffer, the water then reads it back
+    // deferred, the terrain goes through the G-buffer first and is lit
+    // into the scene afterwards
+    if (use_ssr) {
+        ssr.Resize(frame.width, frame.height);
+    }
+    if (frame.deferred_shading) {
+        deferred.Resize(frame.width, frame.height);
+        deferred.BindGBuffer();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    } else if (use_ssr) {
+        ssr.BindScene();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    if (frame.depth_prepass) {
+        ProfileScope scope(profiler, depth_prepass_pass);
+        terrain.DrawDepth(model_matrix);
+    }
+    {
+        ProfileScope scope(profiler, terrain_pass);
+        terrain.Draw(time, model_matrix, frame.depth_prepass, frame.deferred_shading);
+    }
+    if (frame.deferred_shading) {
+        deferred.UnbindGBuffer();
+        glViewport(0, 0, frame.width, frame.height);
+        if (use_ssr) {
+            ssr.BindScene();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        ProfileScope scope(profiler, lighting_pass);
+        deferred.Light(model_matrix, view, frame.projection);
+    }
+    // the sky only shades the pixels the opaque scene left empty
+    {
+        ProfileScope scope(profiler, skybox_pass);
+        skybox.Draw(model_matrix);
+    }
+    if (use_ssr) {
+        ssr.UnbindScene();
+        ProfileScope scope(profiler, hiz_pass);
+        ssr.BuildHiZ();
+        glViewport(0, 0, frame.width, frame.height);
+        ssr.Resolve();
+    }
+
+    water.SetScreenSpaceReflection(use_ssr, ssr.SceneColor(), ssr.HiZ(), ssr.HiZLevels());
+    {
+        ProfileScope scope(profiler, water_pass);
+        water.Draw(time, model_matrix);
+    }
 
-        //reflection.Draw(time, trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
-        terrain.Draw(time, trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
-        skybox.Draw(trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
-        water.Draw(time, trackball_matrix * quad_model_matrix, view_matrix, projection_matrix);
-    //}
+    if (frame.show_profiler) {
+        profiler_overlay.Draw(profiler);
+    }
+    ReportFrameCost(time);
+}
+
+// records the state changes and the mirror updates of the frame with its
+// timings, and shows them in the window title once per second
+void ReportFrameCost(float time) {
+    profiler.CountStateChanges(GlState().Changes(), GlState().Skipped());
+    GlState().ResetCounters();
+    profiler.CountMirrorUpdates(reflection_cache.RefreshCount(), reflection_cache.ReuseCount());
+    reflection_cache.ResetCounters();
+    if (time - last_report_time < 1.0f) {
+        return;
+    }
+    last_report_time = time;
+
+    // only the main thread may set it
+    if (window) {
+        window_title.Write() = profiler.Summary();
+        window_title.Publish();
+    }
+}
+
+// the render thread reads the heightmap back into its own copy, the camera
+// gets it whole
+void UpdateHeightField() {
+    if (heightfield_readback.Update(readback_heightfield) > 0) {
+        std::lock_guard<std::mutex> lock(heightfield_mutex);
+        heightfield = readback_heightfield;
+    }
+}
+
+// writes the recorded frames next to the executable
+void DumpProfile() {
+    if (profiler.DumpCSV("profile.csv") && profiler.DumpJSON("profile.json")) {
+        cout << "profile written to profile.csv and profile.json" << endl;
+    } else {
+        cerr << "could not write the profile" << endl;
+    }
+}
+
+// starts recording the camera, or stops and writes what was recorded
+void ToggleRecording() {
+    if (!recording) {
+        camera_path.Clear();
+        recording = true;
+        cout << "recording the camera" << endl;
+        return;
+    }
+    recording = false;
+    if (camera_path.Save(recording_file)) {
+        cout << camera_path.Size() << " frames (" << camera_path.Duration()
+             << "s) written to " << recording_file << endl;
+    } else {
+        cerr << "could not write " << recording_file << endl;
+    }
+}
+
+// places the camera 'time' seconds into camera_path, looping
+void ReplayCamera(float time) {
+    float duration = camera_path.Duration();
+    CameraSample sample = camera_path.At(duration > 0.0f ? fmod(time, duration) : 0.0f);
+    cam_pos = sample.pos;
+    cam_look = sample.look;
+    cam_up = sample.up;
+}
+
+// reflects the scene about the water plane (y = WATER_LEVEL in model space).
+mat4 MirrorMatrix() {
+    mat4 mirror = translate(IDENTITY_MATRIX, vec3(0.0f, 2.0f * WATER_LEVEL, 0.0f));
+    return scale(mirror, vec3(1.0f, -1.0f, 1.0f));
+}
+
+// screen rectangle (x, y, width, height) covered by the water plane, widened by
+// the maximum wave offset applied when sampling the reflection. falls back to
+// the whole window when the plane crosses the camera plane.
+ivec4 WaterScissor(const mat4 &mvp) {
+    const float wave_margin = 0.1f;
+    const vec2 corners[] = { vec2(-1.0f, -1.0f), vec2(1.0f, -1.0f),
+                             vec2(-1.0f, 1.0f), vec2(1.0f, 1.0f) };
+    vec2 lower = vec2(1.0f);
+    vec2 upper = vec2(-1.0f);
+    for (int i = 0; i < 4; i++) {
+        vec4 clip = mvp * vec4(corners[i].x, WATER_LEVEL, corners[i].y, 1.0f);
+        if (clip.w <= 0.0f) {
+            return ivec4(0, 0, window_width, window_height);
+        }
+        vec2 ndc = vec2(clip) / clip.w;
+        lower = min(lower, ndc);
+        upper = max(upper, ndc);
+    }
+
+    // normalized device coordinates to pixels
+    lower = clamp((lower * 0.5f + 0.5f) - wave_margin, 0.0f, 1.0f);
+    upper = clamp((upper * 0.5f + 0.5f) + wave_margin, 0.0f, 1.0f);
+    vec2 size = vec2(window_width, window_height);
+    ivec2 from = ivec2(floor(lower * size));
+    ivec2 to = ivec2(ceil(upper * size));
+    return ivec4(from, to - from);
 }
 
 // transforms glfw screen coordinates into normalized OpenGL coordinates.
@@ -233,8 +641,7 @@ void ResizeCallback(GLFWwindow* window, int width, int height) {
 
     float ratio = window_width / (float) window_height;
     projection_matrix = perspective(45.0f, ratio, 0.1f, 10.0f);
-
-    glViewport(0, 0, window_width, window_height);
+    // the render thread picks the new size up with the next snapshot
 }
 
 void ErrorCallback(int error, const char* description) {
@@ -244,14 +651,14 @@ void ErrorCallback(int error, const char* description) {
 void handleKeys(){
     if (glfwGetKey(window, GLFW_KEY_W)) {
         decelWS = 1.0;
-        if (camera.isCurrentlyInBezierMode()) {
+        if (camera.isCurrentlyInPathMode()) {
             moveFrontBack += 0.001;
         } else {
             moveFrontBack += 0.01;
         }
     } if (glfwGetKey(window, GLFW_KEY_S)) {
         decelWS = 1.0;
-        if (camera.isCurrentlyInBezierMode()) {
+        if (camera.isCurrentlyInPathMode()) {
             moveFrontBack -= 0.0006;
         } else {
             moveFrontBack -= 0.02;
@@ -337,7 +744,54 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             if(action != GLFW_RELEASE) {
                 return;
             }
-            camera.switchInBezierMode();
+            camera.switchInPathMode();
+            break;
+        }
+        case 'M': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            // the mirror content differs between the two modes
+            reflection_mode = reflection_mode == PLANAR_REFLECTION ?
+                              SCREEN_SPACE_REFLECTION : PLANAR_REFLECTION;
+            cout << "SSR MODE " << (reflection_mode == SCREEN_SPACE_REFLECTION) << endl;
+            break;
+        }
+        case 'H': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            show_profiler = !show_profiler;
+            break;
+        }
+        case 'J': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            profile_dumps++;
+            break;
+        }
+        case 'R': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            ToggleRecording();
+            break;
+        }
+        case 'Z': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            depth_prepass = !depth_prepass;
+            cout << "DEPTH PRE-PASS " << depth_prepass << endl;
+            break;
+        }
+        case 'G': {
+            if(action != GLFW_RELEASE) {
+                return;
+            }
+            deferred_shading = !deferred_shading;
+            cout << "DEFERRED SHADING " << deferred_shading << endl;
             break;
         }
         default:
@@ -345,8 +799,8 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     }
 }
 
-void applyCameraMovements() {
-    camera.moveFrontBack(cam_look, cam_pos, moveFrontBack);
+void applyCameraMovements(float dt) {
+    camera.moveFrontBack(cam_look, cam_pos, moveFrontBack, dt);
     camera.rotateLeftRight(cam_look, cam_pos, rotateLeftRight);
     camera.rotateUpDown(cam_look, cam_pos, rotateUpDown);
 }
@@ -379,7 +833,113 @@ void handleFactors() {
     }
 }
 
-int main(int argc, char *argv[]) {
+// what a headless run renders, see RunHeadless()
+struct HeadlessOptions {
+    int frames = 0;             // 0: 600, or every frame of a replay
+    int width = 1200;
+    int height = 1000;
+    int png_every = 0;          // 0: no screenshots
+    string output = ".";
+    string path = "spline";     // camera: "spline" or "orbit", once over the run,
+                                // or the recording camera_path holds, frame by frame
+    int warmup = 30;            // frames rendered before the measured ones
+    string benchmark;           // statistics of the run as JSON, if not empty
+    string baseline;            // earlier statistics to compare with
+    float threshold = 0.1f;     // relative increase flagged as a regression
+    float frame_rate = 60.0f;   // scene time advances 1 / frame_rate per frame
+};
+
+// releases everything Init() created
+void Cleanup() {
+    terrain.Cleanup();
+    framebuffer_height.Cleanup();
+    framebuffer_mirror.Cleanup();
+    framebuffer_waveheight.Cleanup();
+    framebuffer_wavenormal.Cleanup();
+    heightmap.Cleanup();
+    heightfield_readback.Cleanup();
+    framebuffer_splat.Cleanup();
+    splatmap.Cleanup();
+    water.Cleanup();
+    reflection.Cleanup();
+    camera.Cleanup();
+    wavenormalmap.Cleanup();
+    waveheightmap.Cleanup();
+    ssr.Cleanup();
+    deferred.Cleanup();
+    profiler.Cleanup();
+    profiler_overlay.Cleanup();
+    skybox.Cleanup();
+    skybox_mirror.Cleanup();
+    assets.Cleanup();
+    frame_uniforms.Cleanup();
+    light_uniforms.Cleanup();
+    jobs.Cleanup();
+}
+
+// places the camera for 'frame' of a headless run and returns the scene time,
+// the same for every run
+float ScriptedCamera(const HeadlessOptions &options, int frame) {
+    previous_cam_pos = cam_pos;
+    previous_cam_look = cam_look;
+    previous_cam_up = cam_up;
+    if (replaying) {
+        const CameraSample &sample = camera_path.Frame(std::min(size_t(frame),
+                                                                 camera_path.Size() - 1));
+        cam_pos = sample.pos;
+        cam_look = sample.look;
+        cam_up = sample.up;
+        return sample.time;
+    }
+
+    float progress = frame / float(options.frames);
+    if (options.path == "orbit") {
+        float angle = 2.0f * M_PI * progress;
+        cam_pos = vec3(0.7f * cos(angle), 0.2f, 0.7f * sin(angle));
+        cam_look = vec3(0.0f, 0.0f, 0.0f);
+    } else {
+        camera.pathAt(progress, cam_look, cam_pos);
+    }
+    cam_up = vec3(0.0f, 1.0f, 0.0f);
+    return frame / options.frame_rate;
+}
+
+// the render thread: owns the OpenGL context once Init() is done, and draws
+// the latest snapshot as often as vsync lets it, interpolating the camera
+// between the simulation steps with its own clock
+void RenderLoop() {
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(swap_interval);
+
+    // the textures keep streaming in while the first frames render
+    bool first_frame = true;
+    bool assets_loaded = false;
+
+    while (rendering) {
+        assets.Update();
+
+        snapshots.Acquire();
+        const FrameSnapshot &frame = snapshots.Read();
+        double now = glfwGetTime();
+        float alpha = float((now - frame.time) / simulation.Step());
+        Display(frame, now, std::min(std::max(alpha, 0.0f), 1.0f));
+        glfwSwapBuffers(window);
+
+        if(first_frame) {
+            cout << "first frame after " << glfwGetTime() << "s" << endl;
+            first_frame = false;
+        }
+        if(!assets_loaded && assets.Idle()) {
+            cout << "textures loaded after " << glfwGetTime() << "s" << endl;
+            assets_loaded = true;
+        }
+    }
+
+    Cleanup();
+    glfwMakeContextCurrent(NULL);
+}
+
+int RunWindowed() {
     // GLFW Initialization
     if(!glfwInit()) {
         fprintf(stderr, "Failed to initialize GLFW\n");
@@ -408,6 +968,13 @@ int main(int argc, char *argv[]) {
     // makes the OpenGL context of window current on the calling thread
     glfwMakeContextCurrent(window);
 
+    // adaptive vsync tears instead of dropping to half the rate when late
+    if (swap_interval < 0 && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+        !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+        swap_interval = 1;
+    }
+    glfwSwapInterval(swap_interval);
+
     // set the callback for escape key
     glfwSetKeyCallback(window, KeyCallback);
 
@@ -432,27 +999,225 @@ int main(int argc, char *argv[]) {
     Init(window);
 
 
-    // render loop
+    // the first snapshot is there before the render thread starts, which
+    // takes the context over
+    TakeSnapshot(snapshots.Write(), glfwGetTime());
+    snapshots.Publish();
+    glfwMakeContextCurrent(NULL);
+    rendering = true;
+    std::thread render_thread(RenderLoop);
+
+    // events and simulation: glfw only handles events on the main thread
     while(!glfwWindowShouldClose(window)){
-        Display();
-        glfwSwapBuffers(window);
         glfwPollEvents();
+
+        int steps = simulation.Advance(glfwGetTime());
+        for (int i = steps - 1; i >= 0; i--) {
+            Simulate(simulation.Time() - i * simulation.Step(), simulation.Step());
+        }
+        if (steps > 0) {
+            TakeSnapshot(snapshots.Write(), simulation.Time());
+            snapshots.Publish();
+        }
+        if (window_title.Acquire()) {
+            glfwSetWindowTitle(window, window_title.Read().c_str());
+        }
+
+        // nothing to simulate before the next step
+        double wait = simulation.Time() + simulation.Step() - glfwGetTime();
+        if (wait > 0.0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        }
     }
 
-    terrain.Cleanup();
-    framebuffer_height.Cleanup();
-    framebuffer_mirror.Cleanup();
-    framebuffer_waveheight.Cleanup();
-    framebuffer_wavenormal.Cleanup();
-    heightmap.Cleanup();
-    water.Cleanup();
-    reflection.Cleanup();
-    camera.Cleanup();
-    wavenormalmap.Cleanup();
-    waveheightmap.Cleanup();
+    rendering = false;
+    render_thread.join();
+    if (recording) {
+        ToggleRecording();
+    }
 
     // close OpenGL window and terminate GLFW
     glfwDestroyWindow(window);
     glfwTerminate();
     return EXIT_SUCCESS;
 }
+
+// renders a fixed number of frames offscreen, at a fixed time step so two runs
+// produce the same images, then writes the profile (and optionally the frames)
+// to the output directory. as a benchmark, also writes the statistics of the
+// measured frames and compares them with a baseline.
+int RunHeadless(const HeadlessOptions &options) {
+#ifdef WITH_HEADLESS
+    HeadlessContext context;
+    if(!context.Init()) {
+        return EXIT_FAILURE;
+    }
+
+    glewExperimental = GL_TRUE;
+    if(glewInit() != GLEW_NO_ERROR) {
+        fprintf( stderr, "Failed to initialize GLEW\n");
+        return EXIT_FAILURE;
+    }
+
+    cout << "OpenGL" << glGetString(GL_VERSION) << " (headless)" << endl;
+
+    window_width = options.width;
+    window_height = options.height;
+    context.InitFramebuffer(window_width, window_height);
+    Init(NULL);
+
+    // every frame sees the final textures
+    while(!assets.Idle()) {
+        assets.Update(16);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Benchmark benchmark;
+    vector<unsigned char> pixels;
+    for (int i = -options.warmup; i < options.frames; i++) {
+        int frame = std::max(i, 0);
+        if (i == 0) {
+            benchmark.Begin(profiler);
+        }
+        FrameSnapshot snapshot;
+        float time = ScriptedCamera(options, frame);
+        TakeSnapshot(snapshot, time);
+        Display(snapshot, time);
+        context.Finish();
+
+        if (i >= 0 && options.png_every > 0 && frame % options.png_every == 0) {
+            char filename[32];
+            snprintf(filename, sizeof(filename), "/frame_%05d.png", frame);
+            context.ReadPixels(pixels);
+            if (!png_writer::WritePNG(options.output + filename, window_width,
+                                      window_height, 3, &pixels[0])) {
+                cerr << "could not write " << options.output + filename << endl;
+            }
+        }
+    }
+
+    benchmark.End(profiler);
+
+    bool written = profiler.DumpCSV(options.output + "/profile.csv") &&
+                   profiler.DumpJSON(options.output + "/profile.json");
+    cout << profiler.Summary() << endl;
+    if (!written) {
+        cerr << "could not write the profile to " << options.output << endl;
+    }
+
+    int regressions = 0;
+    if (!options.benchmark.empty()) {
+        char description[512];
+        snprintf(description, sizeof(description),
+                 "{\"path\": \"%s\", \"frames\": %d, \"warmup\": %d, \"width\": %d, "
+                 "\"height\": %d, \"depth_prepass\": %s, \"deferred_shading\": %s, "
+                 "\"procedural_grid\": %s, \"renderer\": \"%s\"}",
+                 options.path.c_str(), options.frames, options.warmup, window_width,
+                 window_height, depth_prepass ? "true" : "false",
+                 deferred_shading ? "true" : "false",
+                 procedural_grid ? "true" : "false",
+                 (const char*) glGetString(GL_RENDERER));
+        if (!benchmark.WriteJSON(options.benchmark, description)) {
+            cerr << "could not write " << options.benchmark << endl;
+            written = false;
+        }
+        if (!options.baseline.empty()) {
+            regressions = benchmark.Compare(options.baseline, options.threshold);
+            cout << (regressions ? "regressed" : "no regression") << " beyond "
+                 << 100.0f * options.threshold << "%" << endl;
+        }
+    }
+
+    Cleanup();
+    context.Cleanup();
+    return written && regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+    (void) options;
+    cerr << "built without EGL, --headless is not available" << endl;
+    return EXIT_FAILURE;
+#endif
+}
+
+// usage: project [--headless [--frames N] [--size WxH] [--png-every K] [--output DIR]
+//                 [--path spline|orbit] [--warmup N]
+//                 [--frame-rate N]]
+//                [--benchmark FILE [--baseline FILE] [--threshold FRACTION]]
+//                [--record FILE] [--replay FILE] [--vsync on|off|adaptive]
+//                [--depth-prepass on|off] [--deferred on|off] [--procedural-grid on|off]
+// --benchmark implies --headless. R starts and stops recording the camera into
+// the --record file (flight.campath by default), --replay flies a recording.
+int main(int argc, char *argv[]) {
+    bool headless = false;
+    HeadlessOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--frames" && has_value) {
+            options.frames = atoi(argv[++i]);
+        } else if (arg == "--size" && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+                options.width = 0;
+            }
+        } else if (arg == "--png-every" && has_value) {
+            options.png_every = atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        } else if (arg == "--path" && has_value) {
+            options.path = argv[++i];
+        } else if (arg == "--warmup" && has_value) {
+            options.warmup = atoi(argv[++i]);
+        } else if (arg == "--frame-rate" && has_value) {
+            options.frame_rate = atof(argv[++i]);
+        } else if (arg == "--benchmark" && has_value) {
+            options.benchmark = argv[++i];
+            headless = true;
+        } else if (arg == "--baseline" && has_value) {
+            options.baseline = argv[++i];
+        } else if (arg == "--threshold" && has_value) {
+            options.threshold = atof(argv[++i]);
+        } else if (arg == "--record" && has_value) {
+            recording_file = argv[++i];
+            recording = true;
+        } else if (arg == "--replay" && has_value) {
+            options.path = argv[++i];
+            if (!camera_path.Load(options.path)) {
+                return EXIT_FAILURE;
+            }
+            replaying = true;
+        } else if (arg == "--vsync" && has_value) {
+            string mode = argv[++i];
+            swap_interval = mode == "off" ? 0 : mode == "adaptive" ? -1 : 1;
+        } else if (arg == "--depth-prepass" && has_value) {
+            depth_prepass = string(argv[++i]) != "off";
+        } else if (arg == "--deferred" && has_value) {
+            deferred_shading = string(argv[++i]) != "off";
+        } else if (arg == "--procedural-grid" && has_value) {
+            procedural_grid = string(argv[++i]) != "off";
+        } else {
+            cerr << "usage: " << argv[0] << " [--headless [--frames N] [--size WxH]"
+                 << " [--png-every K] [--output DIR] [--path spline|orbit] [--warmup N]"
+                 << " [--frame-rate N]]"
+                 << " [--benchmark FILE [--baseline FILE] [--threshold FRACTION]]"
+                 << " [--record FILE] [--replay FILE] [--vsync on|off|adaptive]"
+                 << " [--depth-prepass on|off] [--deferred on|off]"
+                 << " [--procedural-grid on|off]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.frames == 0) {
+        options.frames = replaying ? int(camera_path.Size()) : 600;
+    }
+    if (options.frames <= 0 || options.width <= 0 || options.height <= 0 ||
+        options.warmup < 0 || options.frame_rate <= 0.0f) {
+        cerr << "frames, size and frame rate must be positive" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!replaying && options.path != "spline" && options.path != "orbit") {
+        cerr << "unknown camera path " << options.path << endl;
+        return EXIT_FAILURE;
+    }
+
+    return headless ? RunHeadless(options) : RunWindowed();
+}
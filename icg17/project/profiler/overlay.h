@@ -0,0 +1,112 @@
+#pragma once
+#include "icg_helper.h"
+#include "profiler.h"
+#include "../renderstate/renderstate.h"
+
+// Draws the profiler statistics as bars in the lower left corner: one row per
+// pass with its average GPU time, a tick at its 99th percentile and a thinner
+// bar with its CPU time, then the whole frame. The red line is the budget of
+// a 60 Hz frame.
+class ProfilerOverlay {
+
+    private:
+        GLuint vertex_array_id_;        // vertex array object
+        GLuint program_id_;             // GLSL shader program ID
+        GLuint vertex_buffer_object_;   // memory buffer
+        GLint rect_id_;
+        GLint color_id_;
+
+        const float budget_ms_ = 1000.0f / 60.0f;
+        const float left_ = -0.98f;         // normalized device coordinates
+        const float bottom_ = -0.98f;
+        const float budget_width_ = 0.6f;   // width of a frame budget
+        const float row_height_ = 0.04f;
+
+        // x, y, width, height in normalized device coordinates
+        void Rect(float x, float y, float width, float height, const glm::vec4 &color) {
+            glUniform4f(rect_id_, x, y, width, height);
+            glUniform4fv(color_id_, ONE, &color[0]);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+        float Width(float milliseconds) {
+            return std::min(milliseconds, 2.0f * budget_ms_) / budget_ms_ * budget_width_;
+        }
+
+        void Row(int row, const TimeStats &gpu, const TimeStats &cpu, const glm::vec4 &color) {
+            float y = bottom_ + row * row_height_;
+            Rect(left_, y + 0.3f * row_height_, Width(gpu.avg), 0.6f * row_height_, color);
+            Rect(left_ + Width(gpu.p99), y + 0.2f * row_height_, 0.004f, 0.8f * row_height_,
+                 glm::vec4(1.0f));
+            Rect(left_, y + 0.1f * row_height_, Width(cpu.avg), 0.15f * row_height_,
+                 glm::vec4(0.7f, 0.7f, 0.7f, 1.0f));
+        }
+
+    public:
+        void Init() {
+            program_id_ = icg_helper::LoadShaders("overlay_vshader.glsl",
+                                                  "overlay_fshader.glsl");
+            if(!program_id_) {
+                exit(EXIT_FAILURE);
+            }
+
+            glGenVertexArrays(1, &vertex_array_id_);
+            glBindVertexArray(vertex_array_id_);
+            {
+                const GLfloat vertex_point[] = { /*V1*/ 0.0f, 0.0f,
+                                                 /*V2*/ 1.0f, 0.0f,
+                                                 /*V3*/ 0.0f, 1.0f,
+                                                 /*V4*/ 1.0f, 1.0f};
+                glGenBuffers(1, &vertex_buffer_object_);
+                glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_point),
+                             vertex_point, GL_STATIC_DRAW);
+
+                GLuint vertex_point_id = glGetAttribLocation(program_id_, "vpoint");
+                glEnableVertexAttribArray(vertex_point_id);
+                glVertexAttribPointer(vertex_point_id, 2, GL_FLOAT, DONT_NORMALIZE,
+                                      ZERO_STRIDE, ZERO_BUFFER_OFFSET);
+            }
+            glBindVertexArray(0);
+
+            rect_id_ = glGetUniformLocation(program_id_, "rect");
+            color_id_ = glGetUniformLocation(program_id_, "color");
+        }
+
+        void Cleanup() {
+            glDeleteBuffers(1, &vertex_buffer_object_);
+            glDeleteProgram(program_id_);
+            glDeleteVertexArrays(1, &vertex_array_id_);
+        }
+
+        void Draw(const Profiler &profiler) {
+            static const glm::vec4 colors[] = {
+                glm::vec4(0.9f, 0.6f, 0.1f, 1.0f), glm::vec4(0.2f, 0.7f, 0.9f, 1.0f),
+                glm::vec4(0.3f, 0.8f, 0.3f, 1.0f), glm::vec4(0.8f, 0.3f, 0.8f, 1.0f),
+                glm::vec4(0.9f, 0.9f, 0.3f, 1.0f), glm::vec4(0.2f, 0.4f, 0.9f, 1.0f),
+                glm::vec4(0.9f, 0.4f, 0.4f, 1.0f), glm::vec4(0.5f, 0.9f, 0.7f, 1.0f) };
+
+            ProfileStats stats = profiler.Stats();
+            int passes = int(profiler.PassNames().size());
+
+            GlState().UseProgram(program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Disable(GL_DEPTH_TEST);
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            GlState().Enable(GL_BLEND);
+            GlState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+            // background, then the frame on the first row and a row per pass
+            Rect(left_, bottom_, 2.0f * budget_width_, (passes + 1) * row_height_,
+                 glm::vec4(0.0f, 0.0f, 0.0f, 0.5f));
+            TimeStats none;
+            Row(0, stats.frame, none, glm::vec4(0.9f));
+            for (int pass = 0; pass < passes; pass++) {
+                Row(pass + 1, stats.gpu[pass], stats.cpu[pass], colors[pass]);
+            }
+            Rect(left_ + budget_width_, bottom_, 0.004f, (passes + 1) * row_height_,
+                 glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+
+            GlState().Enable(GL_DEPTH_TEST);
+        }
+};
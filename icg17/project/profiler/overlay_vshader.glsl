@@ -0,0 +1,10 @@
+#version 330 core
+
+in vec2 vpoint;
+
+// x, y, width, height in normalized device coordinates
+uniform vec4 rect;
+
+void main() {
+    gl_Position = vec4(rect.xy + vpoint * rect.zw, 0.0, 1.0);
+}
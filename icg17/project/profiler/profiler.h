@@ -0,0 +1,544 @@
+#pragma once
+#include "icg_helper.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+static const int MAX_PROFILED_PASSES = 8;
+
+// GL_ARB_pipeline_statistics_query, newer than the bundled GLEW
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+// what one frame cost. negative times are passes that did not run.
+struct FrameRecord {
+    unsigned long long frame;               // index of the record in its ring
+    float frame_ms;                         // CPU time from one frame to the next
+    float cpu_ms[MAX_PROFILED_PASSES];
+    float gpu_ms[MAX_PROFILED_PASSES];
+    long long primitives[MAX_PROFILED_PASSES];  // triangles sent down the pipeline
+    long long fragments[MAX_PROFILED_PASSES];   // fragment shader invocations, -1 if not counted
+    int state_changes;                      // GL state set, see RenderState. -1 if not counted
+    int state_skipped;                      // redundant changes RenderState left out
+    int mirror_refreshes;                   // mirror re-rendered, -1 if not counted
+    int mirror_reuses;                      // mirror kept, see ReflectionCache
+};
+
+// The last CAPACITY frame records. One thread pushes without ever waiting,
+// any thread can take a snapshot: every slot carries a sequence number that
+// is odd while the slot is written, readers retry the slots that changed
+// while they copied them.
+template <int CAPACITY>
+class FrameRing {
+
+    private:
+        struct Slot {
+            std::atomic<unsigned> sequence;
+            FrameRecord record;
+        };
+
+        Slot slots_[CAPACITY];
+        std::atomic<unsigned long long> written_;
+
+    public:
+        FrameRing() : written_(0) {
+            for (int i = 0; i < CAPACITY; i++) {
+                slots_[i].sequence.store(0);
+            }
+        }
+
+        void Push(FrameRecord record) {
+            unsigned long long index = written_.load(std::memory_order_relaxed);
+            record.frame = index;
+
+            Slot &slot = slots_[index % CAPACITY];
+            unsigned sequence = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.record = record;
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+            written_.store(index + 1, std::memory_order_release);
+        }
+
+        // the records still in the ring, oldest first
+        vector<FrameRecord> Snapshot() const {
+            unsigned long long written = written_.load(std::memory_order_acquire);
+            unsigned long long count = std::min(written, (unsigned long long) CAPACITY);
+
+            vector<FrameRecord> records;
+            records.reserve(count);
+            for (unsigned long long index = written - count; index < written; index++) {
+                const Slot &slot = slots_[index % CAPACITY];
+                while (true) {
+                    unsigned before = slot.sequence.load(std::memory_order_acquire);
+                    if (before & 1) {
+                        continue;
+                    }
+                    FrameRecord record = slot.record;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                        // skip the slots the writer already reused
+                        if (record.frame == index) {
+                            records.push_back(record);
+                        }
+                        break;
+                    }
+                }
+            }
+            return records;
+        }
+};
+
+// rolling statistics of one measure, over the frames where it was taken
+struct TimeStats {
+    float min = 0.0f;
+    float avg = 0.0f;
+    float p50 = 0.0f;
+    float p95 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+    int count = 0;
+};
+
+struct ProfileStats {
+    TimeStats frame;
+    TimeStats cpu[MAX_PROFILED_PASSES];
+    TimeStats gpu[MAX_PROFILED_PASSES];
+    double primitives[MAX_PROFILED_PASSES];     // per frame, on average
+    double fragments[MAX_PROFILED_PASSES];      // the same, -1 if not counted
+    double state_changes;                       // per frame, on average. -1 if not counted
+    double state_skipped;
+    double mirror_refreshes;                    // per frame, on average. -1 if not counted
+    double mirror_reuses;
+};
+
+// Times named passes of every frame, on the CPU with a steady clock and on the
+// GPU with GL_TIME_ELAPSED queries. The queries of a frame are read back when
+// their slot comes around again, FRAMES_IN_FLIGHT frames later, so that the
+// CPU does not wait on the GPU; the record of the frame is only complete then.
+// Passes can not overlap: GL_TIME_ELAPSED queries do not nest. Every pass also
+// counts the primitives it submits with a GL_PRIMITIVES_GENERATED query, and
+// where the driver has pipeline statistics, the fragments it shades.
+class Profiler {
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+        static const int FRAMES_IN_FLIGHT = 4;
+        static const int HISTORY = 256;
+
+        vector<string> names_;
+        GLuint query_ids_[FRAMES_IN_FLIGHT][MAX_PROFILED_PASSES];
+        GLuint primitive_query_ids_[FRAMES_IN_FLIGHT][MAX_PROFILED_PASSES];
+        GLuint fragment_query_ids_[FRAMES_IN_FLIGHT][MAX_PROFILED_PASSES];
+        bool count_fragments_ = false;
+        bool issued_[FRAMES_IN_FLIGHT][MAX_PROFILED_PASSES];
+        FrameRecord pending_[FRAMES_IN_FLIGHT];     // waiting for their GPU times
+        bool pending_valid_[FRAMES_IN_FLIGHT];
+        int slot_ = 0;
+        bool started_ = false;
+        Clock::time_point frame_start_;
+        Clock::time_point pass_start_[MAX_PROFILED_PASSES];
+        FrameRing<HISTORY> ring_;
+        vector<FrameRecord>* capture_ = NULL;       // every resolved frame, see Capture()
+
+        static float Milliseconds(Clock::time_point from, Clock::time_point to) {
+            return std::chrono::duration<float, std::milli>(to - from).count();
+        }
+
+        static bool HasExtension(const char* name) {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++) {
+                if (!strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), name)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static float Percentile(const vector<float> &sorted, float fraction) {
+            return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * fraction))];
+        }
+
+        static TimeStats Compute(vector<float> &values) {
+            TimeStats stats;
+            if (values.empty()) {
+                return stats;
+            }
+            std::sort(values.begin(), values.end());
+            float sum = 0.0f;
+            for (size_t i = 0; i < values.size(); i++) {
+                sum += values[i];
+            }
+            stats.min = values.front();
+            stats.avg = sum / values.size();
+            stats.p50 = Percentile(values, 0.5f);
+            stats.p95 = Percentile(values, 0.95f);
+            stats.p99 = Percentile(values, 0.99f);
+            stats.max = values.back();
+            stats.count = int(values.size());
+            return stats;
+        }
+
+        // moves a frame whose queries are done into the ring
+        void Resolve(int slot) {
+            if (!pending_valid_[slot]) {
+                return;
+            }
+            FrameRecord &record = pending_[slot];
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                if (issued_[slot][pass]) {
+                    GLuint64 nanoseconds = 0;
+                    glGetQueryObjectui64v(query_ids_[slot][pass], GL_QUERY_RESULT, &nanoseconds);
+                    record.gpu_ms[pass] = nanoseconds * 1e-6f;
+                    GLuint64 primitives = 0;
+                    glGetQueryObjectui64v(primitive_query_ids_[slot][pass], GL_QUERY_RESULT,
+                                          &primitives);
+                    record.primitives[pass] = (long long) primitives;
+                    if (count_fragments_) {
+                        GLuint64 fragments = 0;
+                        glGetQueryObjectui64v(fragment_query_ids_[slot][pass], GL_QUERY_RESULT,
+                                              &fragments);
+                        record.fragments[pass] = (long long) fragments;
+                    }
+                }
+            }
+            ring_.Push(record);
+            if (capture_) {
+                record.frame = capture_->size();
+                capture_->push_back(record);
+            }
+            pending_valid_[slot] = false;
+        }
+
+    public:
+        void Init() {
+            count_fragments_ = HasExtension("GL_ARB_pipeline_statistics_query");
+            for (int slot = 0; slot < FRAMES_IN_FLIGHT; slot++) {
+                glGenQueries(MAX_PROFILED_PASSES, query_ids_[slot]);
+                glGenQueries(MAX_PROFILED_PASSES, primitive_query_ids_[slot]);
+                glGenQueries(MAX_PROFILED_PASSES, fragment_query_ids_[slot]);
+                pending_valid_[slot] = false;
+            }
+        }
+
+        void Cleanup() {
+            for (int slot = 0; slot < FRAMES_IN_FLIGHT; slot++) {
+                glDeleteQueries(MAX_PROFILED_PASSES, query_ids_[slot]);
+                glDeleteQueries(MAX_PROFILED_PASSES, primitive_query_ids_[slot]);
+                glDeleteQueries(MAX_PROFILED_PASSES, fragment_query_ids_[slot]);
+            }
+        }
+
+        // whether the passes count their fragment shader invocations
+        bool CountsFragments() const {
+            return count_fragments_;
+        }
+
+        // returns the id to time the pass with
+        int AddPass(const string &name) {
+            if (names_.size() == MAX_PROFILED_PASSES) {
+                throw(string("Too many profiled passes"));
+            }
+            names_.push_back(name);
+            return int(names_.size()) - 1;
+        }
+
+        const vector<string>& PassNames() const {
+            return names_;
+        }
+
+        // call once at the beginning of every frame
+        void BeginFrame() {
+            Clock::time_point now = Clock::now();
+            if (started_) {
+                pending_[slot_].frame_ms = Milliseconds(frame_start_, now);
+                pending_valid_[slot_] = true;
+            }
+            started_ = true;
+            frame_start_ = now;
+
+            slot_ = (slot_ + 1) % FRAMES_IN_FLIGHT;
+            Resolve(slot_);
+
+            FrameRecord &record = pending_[slot_];
+            record.frame_ms = -1.0f;
+            record.state_changes = -1;
+            record.state_skipped = -1;
+            record.mirror_refreshes = -1;
+            record.mirror_reuses = -1;
+            for (int pass = 0; pass < MAX_PROFILED_PASSES; pass++) {
+                record.cpu_ms[pass] = -1.0f;
+                record.gpu_ms[pass] = -1.0f;
+                record.primitives[pass] = -1;
+                record.fragments[pass] = -1;
+                issued_[slot_][pass] = false;
+            }
+        }
+
+        void BeginPass(int pass) {
+            pass_start_[pass] = Clock::now();
+            glBeginQuery(GL_TIME_ELAPSED, query_ids_[slot_][pass]);
+            glBeginQuery(GL_PRIMITIVES_GENERATED, primitive_query_ids_[slot_][pass]);
+            if (count_fragments_) {
+                glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, fragment_query_ids_[slot_][pass]);
+            }
+        }
+
+        void EndPass(int pass) {
+            if (count_fragments_) {
+                glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+            }
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            glEndQuery(GL_TIME_ELAPSED);
+            issued_[slot_][pass] = true;
+            pending_[slot_].cpu_ms[pass] = Milliseconds(pass_start_[pass], Clock::now());
+        }
+
+        // the GL state changes of the current frame
+        void CountStateChanges(int changes, int skipped) {
+            pending_[slot_].state_changes = changes;
+            pending_[slot_].state_skipped = skipped;
+        }
+
+        // how often the current frame rendered or reused the mirror
+        void CountMirrorUpdates(int refreshes, int reuses) {
+            pending_[slot_].mirror_refreshes = refreshes;
+            pending_[slot_].mirror_reuses = reuses;
+        }
+
+        // waits for the frames still in flight and records them, the current
+        // one included. call between frames, e.g. at the end of a run.
+        void Flush() {
+            if (!started_) {
+                return;
+            }
+            pending_[slot_].frame_ms = Milliseconds(frame_start_, Clock::now());
+            pending_valid_[slot_] = true;
+            for (int i = 1; i <= FRAMES_IN_FLIGHT; i++) {
+                Resolve((slot_ + i) % FRAMES_IN_FLIGHT);
+            }
+            started_ = false;
+        }
+
+        // also appends every frame recorded from now on to 'records', which
+        // the ring would eventually drop. NULL stops.
+        void Capture(vector<FrameRecord>* records) {
+            capture_ = records;
+        }
+
+        vector<FrameRecord> Records() const {
+            return ring_.Snapshot();
+        }
+
+        // statistics over the recorded frames
+        ProfileStats Stats() const {
+            return Stats(Records(), names_.size());
+        }
+
+        // statistics over any frames, e.g. captured ones
+        static ProfileStats Stats(const vector<FrameRecord> &records, size_t num_passes) {
+            ProfileStats stats;
+
+            vector<float> values;
+            for (size_t i = 0; i < records.size(); i++) {
+                values.push_back(records[i].frame_ms);
+            }
+            stats.frame = Compute(values);
+
+            double changes = 0.0;
+            double skipped = 0.0;
+            int counted = 0;
+            for (size_t i = 0; i < records.size(); i++) {
+                if (records[i].state_changes >= 0) {
+                    changes += records[i].state_changes;
+                    skipped += records[i].state_skipped;
+                    counted++;
+                }
+            }
+            stats.state_changes = counted ? changes / counted : -1.0;
+            stats.state_skipped = counted ? skipped / counted : -1.0;
+
+            double refreshes = 0.0;
+            double reuses = 0.0;
+            counted = 0;
+            for (size_t i = 0; i < records.size(); i++) {
+                if (records[i].mirror_refreshes >= 0) {
+                    refreshes += records[i].mirror_refreshes;
+                    reuses += records[i].mirror_reuses;
+                    counted++;
+                }
+            }
+            stats.mirror_refreshes = counted ? refreshes / counted : -1.0;
+            stats.mirror_reuses = counted ? reuses / counted : -1.0;
+
+            for (size_t pass = 0; pass < num_passes; pass++) {
+                vector<float> cpu, gpu;
+                double primitives = 0.0;
+                double fragments = 0.0;
+                int counted = 0;
+                for (size_t i = 0; i < records.size(); i++) {
+                    if (records[i].primitives[pass] >= 0) {
+                        primitives += records[i].primitives[pass];
+                    }
+                    if (records[i].fragments[pass] >= 0) {
+                        fragments += records[i].fragments[pass];
+                        counted++;
+                    }
+                    if (records[i].cpu_ms[pass] >= 0.0f) {
+                        cpu.push_back(records[i].cpu_ms[pass]);
+                    }
+                    if (records[i].gpu_ms[pass] >= 0.0f) {
+                        gpu.push_back(records[i].gpu_ms[pass]);
+                    }
+                }
+                stats.cpu[pass] = Compute(cpu);
+                stats.gpu[pass] = Compute(gpu);
+                stats.primitives[pass] = records.empty() ? 0.0 : primitives / records.size();
+                stats.fragments[pass] = counted ? fragments / counted : -1.0;
+            }
+            return stats;
+        }
+
+        // one line, for the window title
+        string Summary() const {
+            ProfileStats stats = Stats();
+            char buffer[128];
+            snprintf(buffer, sizeof(buffer), "%.2f ms (p99 %.2f)",
+                     stats.frame.avg, stats.frame.p99);
+            string summary = buffer;
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                snprintf(buffer, sizeof(buffer), " | %s %.2f", names_[pass].c_str(),
+                         stats.gpu[pass].avg);
+                summary += buffer;
+            }
+            if (stats.state_changes >= 0.0) {
+                snprintf(buffer, sizeof(buffer), " | state changes %.0f (%.0f skipped)",
+                         stats.state_changes, stats.state_skipped);
+                summary += buffer;
+            }
+            if (stats.mirror_refreshes >= 0.0) {
+                snprintf(buffer, sizeof(buffer), " | mirror refreshes %.2f (%.2f reused)",
+                         stats.mirror_refreshes, stats.mirror_reuses);
+                summary += buffer;
+            }
+            return summary;
+        }
+
+        // one row per frame, times in milliseconds, empty for passes that did not run
+        bool DumpCSV(const string &filename) const {
+            ofstream file(filename.c_str());
+            if (!file.is_open()) {
+                return false;
+            }
+            file << "frame,frame_ms,state_changes,state_skipped,mirror_refreshes,mirror_reuses";
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                file << "," << names_[pass] << "_cpu_ms," << names_[pass] << "_gpu_ms,"
+                     << names_[pass] << "_primitives," << names_[pass] << "_fragments";
+            }
+            file << "\n";
+
+            vector<FrameRecord> records = Records();
+            for (size_t i = 0; i < records.size(); i++) {
+                file << records[i].frame << "," << records[i].frame_ms << ",";
+                if (records[i].state_changes >= 0) {
+                    file << records[i].state_changes << "," << records[i].state_skipped;
+                } else {
+                    file << ",";
+                }
+                file << ",";
+                if (records[i].mirror_refreshes >= 0) {
+                    file << records[i].mirror_refreshes << "," << records[i].mirror_reuses;
+                } else {
+                    file << ",";
+                }
+                for (size_t pass = 0; pass < names_.size(); pass++) {
+                    file << ",";
+                    if (records[i].cpu_ms[pass] >= 0.0f) {
+                        file << records[i].cpu_ms[pass];
+                    }
+                    file << ",";
+                    if (records[i].gpu_ms[pass] >= 0.0f) {
+                        file << records[i].gpu_ms[pass];
+                    }
+                    file << ",";
+                    if (records[i].primitives[pass] >= 0) {
+                        file << records[i].primitives[pass];
+                    }
+                    file << ",";
+                    if (records[i].fragments[pass] >= 0) {
+                        file << records[i].fragments[pass];
+                    }
+                }
+                file << "\n";
+            }
+            return true;
+        }
+
+        // the statistics of every pass, followed by the frames
+        bool DumpJSON(const string &filename) const {
+            ofstream file(filename.c_str());
+            if (!file.is_open()) {
+                return false;
+            }
+            ProfileStats stats = Stats();
+            file << "{\n  \"frame\": " << StatsJSON(stats.frame) << ",\n"
+                 << "  \"state_changes\": " << stats.state_changes << ",\n"
+                 << "  \"state_skipped\": " << stats.state_skipped << ",\n"
+                 << "  \"mirror_refreshes\": " << stats.mirror_refreshes << ",\n"
+                 << "  \"mirror_reuses\": " << stats.mirror_reuses << ",\n  \"passes\": [\n";
+            for (size_t pass = 0; pass < names_.size(); pass++) {
+                file << "    {\"name\": \"" << names_[pass] << "\", \"cpu\": "
+                     << StatsJSON(stats.cpu[pass]) << ", \"gpu\": "
+                     << StatsJSON(stats.gpu[pass]) << ", \"primitives\": "
+                     << (long long) stats.primitives[pass] << ", \"fragments\": "
+                     << (long long) stats.fragments[pass] << "}"
+                     << (pass + 1 < names_.size() ? "," : "") << "\n";
+            }
+            file << "  ],\n  \"frames\": [\n";
+
+            vector<FrameRecord> records = Records();
+            for (size_t i = 0; i < records.size(); i++) {
+                file << "    {\"frame\": " << records[i].frame
+                     << ", \"frame_ms\": " << records[i].frame_ms << ", \"cpu_ms\": [";
+                for (size_t pass = 0; pass < names_.size(); pass++) {
+                    file << (pass ? ", " : "") << records[i].cpu_ms[pass];
+                }
+                file << "], \"gpu_ms\": [";
+                for (size_t pass = 0; pass < names_.size(); pass++) {
+                    file << (pass ? ", " : "") << records[i].gpu_ms[pass];
+                }
+                file << "]}" << (i + 1 < records.size() ? "," : "") << "\n";
+            }
+            file << "  ]\n}\n";
+            return true;
+        }
+
+        static string StatsJSON(const TimeStats &stats) {
+            char buffer[256];
+            snprintf(buffer, sizeof(buffer),
+                     "{\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, "
+                     "\"p99\": %.4f, \"max\": %.4f, \"count\": %d}",
+                     stats.min, stats.avg, stats.p50, stats.p95, stats.p99, stats.max,
+                     stats.count);
+            return buffer;
+        }
+};
+
+// times the enclosing scope as one pass of the profiler
+class ProfileScope {
+
+    private:
+        Profiler &profiler_;
+        int pass_;
+
+    public:
+        ProfileScope(Profiler &profiler, int pass) : profiler_(profiler), pass_(pass) {
+            profiler_.BeginPass(pass_);
+        }
+
+        ~ProfileScope() {
+            profiler_.EndPass(pass_);
+        }
+};
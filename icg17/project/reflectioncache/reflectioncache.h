@@ -0,0 +1,111 @@
+#pragma once
+#include "icg_helper.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <limits>
+
+// Decides when the mirror texture has to be re-rendered. The water samples the
+// mirror through the camera it was rendered with, which reprojects the water
+// surface exactly; what is left is the parallax of the reflected terrain. As
+// long as that parallax stays under 'max_error_' pixels the cached mirror is
+// reused.
+class ReflectionCache {
+
+    private:
+        glm::mat4 cached_mvp_;          // camera the mirror was rendered with
+        glm::ivec4 cached_rect_;        // screen region that was rendered
+        bool valid_ = false;
+        float max_error_;               // allowed parallax error in pixels
+        float water_level_;
+        int refresh_count_ = 0;
+        int reuse_count_ = 0;
+
+        // pixel coordinates of a model space point
+        glm::vec2 Project(const glm::mat4 &mvp, const glm::vec3 &point,
+                          const glm::vec2 &screen) {
+            glm::vec4 clip = mvp * glm::vec4(point, 1.0f);
+            return (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * screen;
+        }
+
+        // largest screen space parallax of the reflected terrain between the
+        // cached camera and the given one. probes are mirrored terrain points
+        // (a mountain of 'reflected_height' above the water) compared to their
+        // foot point on the water plane, whose motion the reprojection undoes.
+        float ParallaxError(const glm::mat4 &mvp, const glm::vec2 &screen) {
+            const float reflected_height = 0.2f;
+            float error = 0.0f;
+            for (int i = -1; i <= 1; i++) {
+                for (int j = -1; j <= 1; j++) {
+                    glm::vec3 foot = glm::vec3(i, water_level_, j);
+                    glm::vec3 probe = foot - glm::vec3(0.0f, reflected_height, 0.0f);
+
+                    // both cameras must see the probes, otherwise refresh
+                    glm::vec4 clip_new = mvp * glm::vec4(probe, 1.0f);
+                    glm::vec4 clip_old = cached_mvp_ * glm::vec4(probe, 1.0f);
+                    if (clip_new.w <= 0.0f || clip_old.w <= 0.0f) {
+                        return std::numeric_limits<float>::max();
+                    }
+
+                    glm::vec2 probe_motion = Project(mvp, probe, screen) -
+                                             Project(cached_mvp_, probe, screen);
+                    glm::vec2 foot_motion = Project(mvp, foot, screen) -
+                                            Project(cached_mvp_, foot, screen);
+                    error = glm::max(error, glm::length(probe_motion - foot_motion));
+                }
+            }
+            return error;
+        }
+
+    public:
+        void Init(float water_level, float max_error = 1.5f) {
+            this->water_level_ = water_level;
+            this->max_error_ = max_error;
+            valid_ = false;
+        }
+
+        // forces a refresh, e.g. when the terrain or the window changes
+        void Invalidate() {
+            valid_ = false;
+        }
+
+        // true when the mirror has to be re-rendered for the given camera and
+        // water region ('rect' in pixels, as given to glScissor)
+        bool NeedsUpdate(const glm::mat4 &mvp, const glm::ivec4 &rect,
+                         int width, int height) {
+            bool contained = rect.x >= cached_rect_.x && rect.y >= cached_rect_.y &&
+                             rect.x + rect.z <= cached_rect_.x + cached_rect_.z &&
+                             rect.y + rect.w <= cached_rect_.y + cached_rect_.w;
+            if (!valid_ || !contained ||
+                ParallaxError(mvp, glm::vec2(width, height)) > max_error_) {
+                refresh_count_++;
+                return true;
+            }
+            reuse_count_++;
+            return false;
+        }
+
+        // records the camera the mirror was just rendered with
+        void Update(const glm::mat4 &mvp, const glm::ivec4 &rect) {
+            cached_mvp_ = mvp;
+            cached_rect_ = rect;
+            valid_ = true;
+        }
+
+        // camera to project the water with when sampling the mirror
+        const glm::mat4 &ViewProjection() const {
+            return cached_mvp_;
+        }
+
+        // counters since the last ResetCounters()
+        int RefreshCount() const {
+            return refresh_count_;
+        }
+
+        int ReuseCount() const {
+            return reuse_count_;
+        }
+
+        void ResetCounters() {
+            refresh_count_ = 0;
+            reuse_count_ = 0;
+        }
+};
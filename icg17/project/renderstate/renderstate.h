@@ -0,0 +1,164 @@
+#pragma once
+#include "icg_helper.h"
+#include <map>
+
+static const int MAX_TEXTURE_UNITS = 16;
+
+// Remembers the GL state set through it and skips the calls that would not
+// change anything, counting them. Draws set the state they need instead of
+// restoring the defaults afterwards. Code changing the same state behind its
+// back (initialization, mostly) has to call Invalidate() afterwards.
+class RenderState {
+
+    private:
+        static const GLuint UNKNOWN = GLuint(-1);
+        static const int NUM_TARGETS = 3;   // 2D, 2D array, cube map
+
+        GLuint program_id_;
+        GLuint vertex_array_id_;
+        GLuint active_unit_;
+        GLuint textures_[MAX_TEXTURE_UNITS][NUM_TARGETS];
+        std::map<GLenum, bool> capabilities_;   // missing ones are unknown
+        GLenum blend_src_;
+        GLenum blend_dst_;
+        GLenum depth_func_;
+
+        int changes_ = 0;       // calls that reached the driver
+        int skipped_ = 0;       // redundant calls avoided
+
+        static int TargetIndex(GLenum target) {
+            switch(target) {
+                case GL_TEXTURE_2D_ARRAY: return 1;
+                case GL_TEXTURE_CUBE_MAP: return 2;
+                default: return 0;
+            }
+        }
+
+        // true when the value has to be sent to the driver
+        template <typename T>
+        bool Differs(T &current, T value) {
+            if(current == value) {
+                skipped_++;
+                return false;
+            }
+            current = value;
+            changes_++;
+            return true;
+        }
+
+    public:
+        RenderState() {
+            Invalidate();
+        }
+
+        // forget everything, the next calls all reach the driver
+        void Invalidate() {
+            program_id_ = UNKNOWN;
+            vertex_array_id_ = UNKNOWN;
+            active_unit_ = UNKNOWN;
+            for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+                for (int target = 0; target < NUM_TARGETS; target++) {
+                    textures_[unit][target] = UNKNOWN;
+                }
+            }
+            capabilities_.clear();
+            blend_src_ = UNKNOWN;
+            blend_dst_ = UNKNOWN;
+            depth_func_ = UNKNOWN;
+        }
+
+        void UseProgram(GLuint program_id) {
+            if(Differs(program_id_, program_id)) {
+                glUseProgram(program_id);
+            }
+        }
+
+        void BindVertexArray(GLuint vertex_array_id) {
+            if(Differs(vertex_array_id_, vertex_array_id)) {
+                glBindVertexArray(vertex_array_id);
+            }
+        }
+
+        // 'unit' is GL_TEXTURE0 + i, as for glActiveTexture
+        void ActiveTexture(GLenum unit) {
+            if(Differs(active_unit_, GLuint(unit))) {
+                glActiveTexture(unit);
+            }
+        }
+
+        // leaves 'unit' active only when the binding changed, call
+        // ActiveTexture() before modifying the bound texture
+        void BindTexture(GLenum unit, GLenum target, GLuint texture_id) {
+            int index = int(unit - GL_TEXTURE0);
+            if(index >= MAX_TEXTURE_UNITS) {
+                glActiveTexture(unit);
+                active_unit_ = unit;
+                glBindTexture(target, texture_id);
+                return;
+            }
+            if(Differs(textures_[index][TargetIndex(target)], texture_id)) {
+                ActiveTexture(unit);
+                glBindTexture(target, texture_id);
+            }
+        }
+
+        void Enable(GLenum capability) {
+            Set(capability, true);
+        }
+
+        void Disable(GLenum capability) {
+            Set(capability, false);
+        }
+
+        void Set(GLenum capability, bool enabled) {
+            std::map<GLenum, bool>::iterator it = capabilities_.find(capability);
+            if(it != capabilities_.end() && it->second == enabled) {
+                skipped_++;
+                return;
+            }
+            capabilities_[capability] = enabled;
+            changes_++;
+            if(enabled) {
+                glEnable(capability);
+            } else {
+                glDisable(capability);
+            }
+        }
+
+        void BlendFunc(GLenum source, GLenum destination) {
+            if(blend_src_ == source && blend_dst_ == destination) {
+                skipped_++;
+                return;
+            }
+            blend_src_ = source;
+            blend_dst_ = destination;
+            changes_++;
+            glBlendFunc(source, destination);
+        }
+
+        void DepthFunc(GLenum function) {
+            if(Differs(depth_func_, function)) {
+                glDepthFunc(function);
+            }
+        }
+
+        // counters since the last ResetCounters()
+        int Changes() const {
+            return changes_;
+        }
+
+        int Skipped() const {
+            return skipped_;
+        }
+
+        void ResetCounters() {
+            changes_ = 0;
+            skipped_ = 0;
+        }
+};
+
+// the state of the one GL context
+inline RenderState& GlState() {
+    static RenderState state;
+    return state;
+}
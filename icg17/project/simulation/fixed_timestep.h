@@ -0,0 +1,46 @@
+#pragma once
+#include "icg_helper.h"
+
+// Runs the simulation (input, camera) in steps of a fixed length, however
+// often frames are rendered: Advance() tells how many steps catch up with the
+// clock, Time() which clock time the last one reached.
+class FixedTimestep {
+
+    private:
+        double step_;
+        int max_steps_;
+        double accumulator_ = 0.0;
+        double last_time_ = -1.0;
+
+    public:
+        // after a long stall only 'max_steps' are run, the rest of the time
+        // is dropped rather than simulated all at once
+        FixedTimestep(double step = 1.0 / 60.0, int max_steps = 8)
+            : step_(step), max_steps_(max_steps) {
+        }
+
+        float Step() const {
+            return float(step_);
+        }
+
+        // steps to run to reach 'time' (seconds)
+        int Advance(double time) {
+            if (last_time_ < 0.0) {
+                last_time_ = time;
+            }
+            accumulator_ += time - last_time_;
+            last_time_ = time;
+
+            int steps = int(accumulator_ / step_);
+            accumulator_ -= steps * step_;
+            if (steps > max_steps_) {
+                steps = max_steps_;
+            }
+            return steps;
+        }
+
+        // the clock time the last step reached
+        double Time() const {
+            return last_time_ - accumulator_;
+        }
+};
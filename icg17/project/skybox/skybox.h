@@ -2,7 +2,13 @@
 #include "icg_helper.h"
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "../assets/asset_manager.h"
+#include "../uniforms/uniform_buffer.h"
+#include "../renderstate/renderstate.h"
+#include "../texture/image.h"
 
+// where the faces of the cube are in the 3x4 cross of skybox.tga: the cube map
+// is built from these at load time
 static const float maxSize = 5.0f; // Easier to scale the cube
 static const unsigned int NbCubeVertices = 36;
 static const glm::vec3 CubeVertices[] =
@@ -93,17 +99,94 @@ static const glm::vec2 CubeUVs[] =
 };
 
 
+// the six size x size faces of the cube map, one above the other, sampled
+// from the cross 'atlas' through the triangles above
+inline Image CubeMapFromAtlas(const Image &atlas, int size) {
+    Image faces;
+    faces.width = size;
+    faces.height = 6 * size;
+    faces.components = atlas.components;
+    faces.pixels.resize(size_t(faces.width) * faces.height * faces.components);
+
+    for (int face = 0; face < 6; face++) {
+        int axis = face / 2;
+        float side = face % 2 ? -maxSize : maxSize;
+        // the two other axes span the face
+        int a = (axis + 1) % 3;
+        int b = (axis + 2) % 3;
+
+        // the triangles lying on that face
+        vector<int> triangles;
+        for (unsigned int t = 0; t < NbCubeVertices; t += 3) {
+            if (CubeVertices[t][axis] == side && CubeVertices[t + 1][axis] == side &&
+                CubeVertices[t + 2][axis] == side) {
+                triangles.push_back(t);
+            }
+        }
+
+        for (int j = 0; j < size; j++) {
+            for (int i = 0; i < size; i++) {
+                // the direction of texel (i, j), see the cube map face
+                // selection of the GL specification
+                float sc = 2.0f * (i + 0.5f) / size - 1.0f;
+                float tc = 2.0f * (j + 0.5f) / size - 1.0f;
+                glm::vec3 direction;
+                switch (face) {
+                    case 0: direction = glm::vec3(1.0f, -tc, -sc); break;
+                    case 1: direction = glm::vec3(-1.0f, -tc, sc); break;
+                    case 2: direction = glm::vec3(sc, 1.0f, tc); break;
+                    case 3: direction = glm::vec3(sc, -1.0f, -tc); break;
+                    case 4: direction = glm::vec3(sc, -tc, 1.0f); break;
+                    default: direction = glm::vec3(-sc, -tc, -1.0f); break;
+                }
+                glm::vec2 point = glm::vec2(direction[a], direction[b]) * maxSize;
+
+                // the triangle containing the point best, and where in it
+                float best = -1e9f;
+                glm::vec2 uv(0.0f);
+                for (size_t k = 0; k < triangles.size(); k++) {
+                    int t = triangles[k];
+                    glm::vec2 p0(CubeVertices[t][a], CubeVertices[t][b]);
+                    glm::vec2 p1(CubeVertices[t + 1][a], CubeVertices[t + 1][b]);
+                    glm::vec2 p2(CubeVertices[t + 2][a], CubeVertices[t + 2][b]);
+                    glm::vec2 e1 = p1 - p0;
+                    glm::vec2 e2 = p2 - p0;
+                    glm::vec2 d = point - p0;
+                    float area = e1.x * e2.y - e1.y * e2.x;
+                    float w1 = (d.x * e2.y - d.y * e2.x) / area;
+                    float w2 = (e1.x * d.y - e1.y * d.x) / area;
+                    float w0 = 1.0f - w1 - w2;
+                    float inside = std::min(w0, std::min(w1, w2));
+                    if (inside > best) {
+                        best = inside;
+                        uv = w0 * CubeUVs[t] + w1 * CubeUVs[t + 1] + w2 * CubeUVs[t + 2];
+                    }
+                }
+
+                size_t texel = (size_t(face) * size * size + size_t(j) * size + i) *
+                               faces.components;
+                SampleImage(atlas, uv.x, uv.y, &faces.pixels[texel]);
+            }
+        }
+    }
+    return faces;
+}
+
+// Draws the sky behind everything else: a triangle covering the screen at the
+// far plane, looking up a cube map with the direction of each pixel. Drawn
+// after the opaque geometry, the depth test leaves only the sky pixels to shade.
 class Skybox {
 
     private:
-        GLuint vertex_array_id_;        // vertex array object
+        static const int FACE_SIZE = 512;
+
+        GLuint vertex_array_id_;        // vertex array object, without attributes
         GLuint program_id_;             // GLSL shader program ID
-        GLuint vertex_buffer_object_;   // memory buffer
-        GLuint texture_id_;
-        GLboolean isReflection;
+        GLuint texture_id_;             // cube map, owned by the asset manager
+        GLint model_id_;
 
     public:
-        void Init(GLboolean isReflection = false) {
+        void Init(AssetManager &assets) {
 
             // compile the shaders.
             program_id_ = icg_helper::LoadShaders("skybox_vshader.glsl",
@@ -114,112 +197,44 @@ class Skybox {
 
             glUseProgram(program_id_);
 
-            // vertex one vertex array
+            // the corners come from gl_VertexID, but a vertex array has to be bound
             glGenVertexArrays(1, &vertex_array_id_);
-            glBindVertexArray(vertex_array_id_);
-
-            // vertex coordinates
-            {
-                // buffer
-                glGenBuffers(1, &vertex_buffer_object_);
-                glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_);
-                glBufferData(GL_ARRAY_BUFFER, NbCubeVertices * sizeof(glm::vec3),
-                             &CubeVertices[0], GL_STATIC_DRAW);
-
-                // attribute
-                GLuint vertex_point_id = glGetAttribLocation(program_id_, "vpoint");
-                glEnableVertexAttribArray(vertex_point_id);
-                glVertexAttribPointer(vertex_point_id, 3, GL_FLOAT, DONT_NORMALIZE,
-                                      ZERO_STRIDE, ZERO_BUFFER_OFFSET);
-            }
-
-            // texture coordinates
-            {
-                // buffer
-                glGenBuffers(1, &vertex_buffer_object_);
-                glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_);
-                glBufferData(GL_ARRAY_BUFFER, NbCubeUVs * sizeof(glm::vec2),
-                             &CubeUVs[0], GL_STATIC_DRAW);
-
-                // attribute
-                GLuint vertex_texture_coord_id = glGetAttribLocation(program_id_,
-                                                                     "vtexcoord");
-                glEnableVertexAttribArray(vertex_texture_coord_id);
-                glVertexAttribPointer(vertex_texture_coord_id, 2, GL_FLOAT,
-                                      DONT_NORMALIZE, ZERO_STRIDE, ZERO_BUFFER_OFFSET);
-            }
-
-            this->isReflection = isReflection;
 
-            // load texture
-            {
-                int width;
-                int height;
-                int nb_component;
-                string texture_filename = "../../textures/skybox.tga";
-                stbi_set_flip_vertically_on_load(1);
-                unsigned char* image = stbi_load(texture_filename.c_str(),
-                                                 &width, &height, &nb_component, 0);
-
-                if(image == nullptr) {
-                    throw(std::string("Failed to load texture"));
-                }
-
-                glGenTextures(1, &texture_id_);
-                glBindTexture(GL_TEXTURE_2D, texture_id_);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-                if(nb_component == 3) {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
-                                 GL_RGB, GL_UNSIGNED_BYTE, image);
-                } else if(nb_component == 4) {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
-                                 GL_RGBA, GL_UNSIGNED_BYTE, image);
-                }
-
-                GLuint tex_id = glGetUniformLocation(program_id_, "tex");
-                glUniform1i(tex_id, 0 /*GL_TEXTURE0*/);
-
-                // cleanup
-                glBindTexture(GL_TEXTURE_2D, 0);
-                stbi_image_free(image);
-            }
+            // cube map, shared with the other skyboxes
+            texture_id_ = assets.RequestCubeMap("skybox.tga", FACE_SIZE, [](const Image &atlas) {
+                return CubeMapFromAtlas(atlas, FACE_SIZE);
+            });
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+            GLuint sky_id = glGetUniformLocation(program_id_, "sky");
+            glUniform1i(sky_id, 0 /*GL_TEXTURE0*/);
+
+            // view and projection come from the frame uniform block
+            BindUniformBlock(program_id_, "Frame", FRAME_UNIFORMS_BINDING);
+            model_id_ = glGetUniformLocation(program_id_, "model");
         }
 
         void Cleanup() {
             glBindVertexArray(0);
             glUseProgram(0);
-            glDeleteBuffers(1, &vertex_buffer_object_);
             glDeleteProgram(program_id_);
             glDeleteVertexArrays(1, &vertex_array_id_);
-            glDeleteTextures(1, &texture_id_);
         }
 
-        void Draw(const glm::mat4 &model = IDENTITY_MATRIX,
-                  const glm::mat4 &view = IDENTITY_MATRIX,
-                  const glm::mat4 &projection = IDENTITY_MATRIX){
-            glUseProgram(program_id_);
-            glBindVertexArray(vertex_array_id_);
+        // only the model's rotation and scale matter, the sky is infinitely far
+        void Draw(const glm::mat4 &model = IDENTITY_MATRIX){
+            GlState().UseProgram(program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Disable(GL_BLEND);
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            // the triangle lies on the far plane, where the cleared depth is
+            GlState().DepthFunc(GL_LEQUAL);
 
             // bind textures
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture_id_);
-
-            glUniform1i(glGetUniformLocation(program_id_, "isReflection"), this->isReflection);
-
-            GLint model_id = glGetUniformLocation(program_id_, "model");
-            glUniformMatrix4fv(model_id, ONE, DONT_TRANSPOSE, glm::value_ptr(model));
+            GlState().BindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, texture_id_);
 
-            GLint view_id = glGetUniformLocation(program_id_, "view");
-            glUniformMatrix4fv(view_id, ONE, DONT_TRANSPOSE, glm::value_ptr(view));
-            GLint projection_id = glGetUniformLocation(program_id_, "projection");
-            glUniformMatrix4fv(projection_id, ONE, DONT_TRANSPOSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(model_id_, ONE, DONT_TRANSPOSE, glm::value_ptr(model));
 
             // draw
-            glDrawArrays(GL_TRIANGLES,0, NbCubeVertices);
-
-            glBindVertexArray(0);
-            glUseProgram(0);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
         }
 };
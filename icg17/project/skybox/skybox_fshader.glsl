@@ -1,16 +1,11 @@
 #version 330 core
 
-uniform sampler2D tex;
-uniform bool isReflection;
+uniform samplerCube sky;
 
-in vec2 uv;
+in vec3 direction;
 
 out vec3 color;
 
 void main(){
-	if (isReflection) {
-		color = texture(tex, vec2(1-uv.x, uv.y)).rgb;
-	} else {
-		color = texture(tex, uv).rgb;
-	}
+	color = texture(sky, direction).rgb;
 }
@@ -1,18 +1,22 @@
 #version 330 core
 
-uniform mat4 view;
-uniform mat4 projection;
 uniform mat4 model;
-uniform bool isReflection;
 
+// shared by all the programs, see uniforms/uniform_buffer.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
 
-in vec3 vpoint;
-in vec2 vtexcoord;
-
-out vec2 uv;
+out vec3 direction;
 
 void main(){
-	gl_Position = projection * view * model * vec4(vpoint,1.0); 
+    // (-1, -1), (3, -1), (-1, 3): one triangle covering the screen, on the far plane
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(corner, 1.0, 1.0);
 
-    uv = vtexcoord;
+    // back to a direction in the sky's space, without the camera's position
+    vec4 world = inverse(projection * mat4(mat3(view))) * gl_Position;
+    direction = inverse(mat3(model)) * (world.xyz / world.w);
 }
@@ -0,0 +1,90 @@
+#pragma once
+#include "icg_helper.h"
+
+// Bakes how much of each material covers the terrain, from its height and
+// slope, so that the terrain shader does not have to work it out for every
+// fragment. Has to be drawn again whenever the heightmap changes.
+// r: sand, g: grass, b: rock, a: snow, the seabed takes what is left.
+class SplatMap {
+
+    private:
+        GLuint vertex_array_id_;        // vertex array object
+        GLuint program_id_;             // GLSL shader program ID
+        GLuint vertex_buffer_object_;   // memory buffer
+        GLuint heightmap_id_;
+        float heightmap_width_;
+        float heightmap_height_;
+
+    public:
+        void Init(GLuint heightmap, float heightmap_width, float heightmap_height) {
+            // compile the shaders
+            program_id_ = icg_helper::LoadShaders("splatmap_vshader.glsl",
+                                                  "splatmap_fshader.glsl");
+            if(!program_id_) {
+                exit(EXIT_FAILURE);
+            }
+
+            glUseProgram(program_id_);
+
+            // vertex one vertex Array
+            glGenVertexArrays(1, &vertex_array_id_);
+            glBindVertexArray(vertex_array_id_);
+
+            // vertex coordinates, the texture coordinates are derived from them
+            {
+                const GLfloat vertex_point[] = { /*V1*/ -1.0f, -1.0f,
+                                                 /*V2*/ +1.0f, -1.0f,
+                                                 /*V3*/ -1.0f, +1.0f,
+                                                 /*V4*/ +1.0f, +1.0f};
+                // buffer
+                glGenBuffers(1, &vertex_buffer_object_);
+                glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_point),
+                             vertex_point, GL_STATIC_DRAW);
+
+                // attribute
+                GLuint vertex_point_id = glGetAttribLocation(program_id_, "vpoint");
+                glEnableVertexAttribArray(vertex_point_id);
+                glVertexAttribPointer(vertex_point_id, 2, GL_FLOAT, DONT_NORMALIZE,
+                                      ZERO_STRIDE, ZERO_BUFFER_OFFSET);
+            }
+
+            this->heightmap_id_ = heightmap;
+            this->heightmap_width_ = heightmap_width;
+            this->heightmap_height_ = heightmap_height;
+
+            GLuint heightmap_id = glGetUniformLocation(program_id_, "heightMap");
+            glUniform1i(heightmap_id, 0 /*GL_TEXTURE0*/);
+
+            // to avoid the current object being polluted
+            glBindVertexArray(0);
+            glUseProgram(0);
+        }
+
+        void Cleanup() {
+            glBindVertexArray(0);
+            glUseProgram(0);
+            glDeleteBuffers(1, &vertex_buffer_object_);
+            glDeleteProgram(program_id_);
+            glDeleteVertexArrays(1, &vertex_array_id_);
+        }
+
+        void Draw() {
+            glUseProgram(program_id_);
+            glBindVertexArray(vertex_array_id_);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, heightmap_id_);
+
+            glUniform1f(glGetUniformLocation(program_id_, "heightmap_width"),
+                        this->heightmap_width_);
+            glUniform1f(glGetUniformLocation(program_id_, "heightmap_height"),
+                        this->heightmap_height_);
+
+            // draw
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+            glBindVertexArray(0);
+            glUseProgram(0);
+        }
+};
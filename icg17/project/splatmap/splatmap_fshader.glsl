@@ -0,0 +1,55 @@
+#version 330
+
+in vec2 uv;
+
+uniform sampler2D heightMap;
+uniform float heightmap_width;
+uniform float heightmap_height;
+
+// r: sand, g: grass, b: rock, a: snow. the seabed is 1 - (r + g + b + a).
+out vec4 weights;
+
+// material boundaries, each transition is 'epsilon' wide
+const float sandMin = 0.130f;
+const float forestMin = 0.135f;
+const float rockMin = 0.18f;
+const float snowMin = 0.26f;
+const float epsilon = 0.02f;
+
+// grass gives way to rock where the terrain gets steep, as 1 - normal.y
+const float steepMin = 0.3f;
+const float steepMax = 0.5f;
+
+// share of the terrain above a transition starting at 'level'
+float above(float height, float level) {
+    return clamp((height - level) / epsilon, 0.0f, 1.0f);
+}
+
+void main() {
+    float height = texture(heightMap, uv).r;
+
+    // slope in model space, where the terrain spans [-1, 1]
+    vec2 dx = vec2(1.0 / heightmap_width, 0.0);
+    vec2 dy = vec2(0.0, 1.0 / heightmap_height);
+    float dhdx = (texture(heightMap, uv + dx).r - texture(heightMap, uv - dx).r) * heightmap_width / 4.0;
+    float dhdy = (texture(heightMap, uv + dy).r - texture(heightMap, uv - dy).r) * heightmap_height / 4.0;
+    float steepness = 1.0 - normalize(vec3(-dhdx, 1.0, -dhdy)).y;
+
+    // the bands follow each other, so each material gets what is above its
+    // lower transition and not above the next one
+    float sand_up = above(height, sandMin - epsilon);
+    float grass_up = above(height, forestMin);
+    float rock_up = above(height, rockMin);
+    float snow_up = above(height, snowMin);
+
+    float sand = sand_up - grass_up;
+    float grass = grass_up - rock_up;
+    float rock = rock_up - snow_up;
+    float snow = snow_up;
+
+    float steep = smoothstep(steepMin, steepMax, steepness);
+    rock += grass * steep;
+    grass -= grass * steep;
+
+    weights = vec4(sand, grass, rock, snow);
+}
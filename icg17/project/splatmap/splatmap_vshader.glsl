@@ -0,0 +1,9 @@
+#version 330 core
+
+in vec2 vpoint;
+out vec2 uv;
+
+void main() {
+    gl_Position = vec4(vpoint, 0.0, 1.0);
+    uv = (vpoint + vec2(1.0, 1.0)) * 0.5;
+}
@@ -0,0 +1,38 @@
+#version 330
+
+uniform sampler2D depth;
+uniform sampler2D previous;     // only the previous level is accessible
+uniform int level;
+
+out float min_depth;
+
+float fetch(ivec2 coord, ivec2 size) {
+    return texelFetch(previous, min(coord, size - 1), 0).r;
+}
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+
+    if (level == 0) {
+        min_depth = texelFetch(depth, coord, 0).r;
+        return;
+    }
+
+    ivec2 size = textureSize(previous, 0);
+    ivec2 p = 2 * coord;
+    min_depth = min(min(fetch(p, size), fetch(p + ivec2(1, 0), size)),
+                    min(fetch(p + ivec2(0, 1), size), fetch(p + ivec2(1, 1), size)));
+
+    // odd sized levels: the last row/column also covers the remaining texels
+    bool extra_x = (size.x & 1) != 0 && p.x + 3 == size.x;
+    bool extra_y = (size.y & 1) != 0 && p.y + 3 == size.y;
+    if (extra_x) {
+        min_depth = min(min_depth, min(fetch(p + ivec2(2, 0), size), fetch(p + ivec2(2, 1), size)));
+    }
+    if (extra_y) {
+        min_depth = min(min_depth, min(fetch(p + ivec2(0, 2), size), fetch(p + ivec2(1, 2), size)));
+    }
+    if (extra_x && extra_y) {
+        min_depth = min(min_depth, fetch(p + ivec2(2, 2), size));
+    }
+}
@@ -0,0 +1,12 @@
+#version 330
+
+uniform sampler2D scene_color;
+uniform sampler2D scene_depth;
+
+out vec3 color;
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    color = texelFetch(scene_color, coord, 0).rgb;
+    gl_FragDepth = texelFetch(scene_depth, coord, 0).r;
+}
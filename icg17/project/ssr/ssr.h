@@ -0,0 +1,193 @@
+#pragma once
+#include "icg_helper.h"
+#include "../framebuffer/framebuffer.h"
+#include "../renderstate/renderstate.h"
+
+// Screen space reflection support. The opaque scene is rendered into its own
+// framebuffer so that the water can ray-march a min-depth (Hi-Z) pyramid of it
+// and fetch the reflected colors, before the scene is resolved to the screen.
+class ScreenSpaceReflection {
+
+    private:
+        GLuint vertex_array_id_;        // vertex array object
+        GLuint vertex_buffer_object_;   // memory buffer
+        GLuint hiz_program_id_;         // builds one level of the pyramid
+        GLuint resolve_program_id_;     // copies the scene to the screen
+        GLuint hiz_texture_id_;         // min depth pyramid
+        GLuint hiz_framebuffer_id_;
+        FrameBuffer framebuffer_scene_;
+        GLuint scene_color_id_;
+        int width_;
+        int height_;
+        int levels_;
+
+        // (re)allocates the scene and the pyramid at the current size
+        void CreateTargets() {
+            levels_ = int(floor(log2(float(std::max(width_, height_))))) + 1;
+
+            // scene color and depth
+            scene_color_id_ = framebuffer_scene_.Init(width_, height_, true, GL_RGB,
+                                                      GL_RGB8, true);
+
+            // min depth pyramid, every level is rendered separately
+            glGenTextures(1, &hiz_texture_id_);
+            glBindTexture(GL_TEXTURE_2D, hiz_texture_id_);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            for (int level = 0; level < levels_; level++) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_R32F,
+                             std::max(1, width_ >> level), std::max(1, height_ >> level), 0,
+                             GL_RED, GL_FLOAT, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        void DeleteTargets() {
+            glDeleteTextures(1, &hiz_texture_id_);
+            framebuffer_scene_.Cleanup();
+        }
+
+    public:
+        void Init(int width, int height) {
+            this->width_ = width;
+            this->height_ = height;
+
+            // compile the shaders
+            hiz_program_id_ = icg_helper::LoadShaders("ssr_vshader.glsl",
+                                                      "hiz_fshader.glsl");
+            resolve_program_id_ = icg_helper::LoadShaders("ssr_vshader.glsl",
+                                                          "resolve_fshader.glsl");
+            if(!hiz_program_id_ || !resolve_program_id_) {
+                exit(EXIT_FAILURE);
+            }
+
+            // fullscreen quad, shared by both programs
+            glGenVertexArrays(1, &vertex_array_id_);
+            glBindVertexArray(vertex_array_id_);
+            {
+                const GLfloat vertex_point[] = { /*V1*/ -1.0f, -1.0f, 0.0f,
+                                                 /*V2*/ +1.0f, -1.0f, 0.0f,
+                                                 /*V3*/ -1.0f, +1.0f, 0.0f,
+                                                 /*V4*/ +1.0f, +1.0f, 0.0f};
+                glGenBuffers(1, &vertex_buffer_object_);
+                glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_point),
+                             vertex_point, GL_STATIC_DRAW);
+
+                // 'vpoint' has an explicit location shared by both programs
+                GLuint vertex_point_id = 0;
+                glEnableVertexAttribArray(vertex_point_id);
+                glVertexAttribPointer(vertex_point_id, 3, GL_FLOAT, DONT_NORMALIZE,
+                                      ZERO_STRIDE, ZERO_BUFFER_OFFSET);
+            }
+            glBindVertexArray(0);
+
+            CreateTargets();
+            glGenFramebuffers(1, &hiz_framebuffer_id_);
+
+            glUseProgram(hiz_program_id_);
+            glUniform1i(glGetUniformLocation(hiz_program_id_, "depth"), 0 /*GL_TEXTURE0*/);
+            glUniform1i(glGetUniformLocation(hiz_program_id_, "previous"), 1 /*GL_TEXTURE1*/);
+            glUseProgram(resolve_program_id_);
+            glUniform1i(glGetUniformLocation(resolve_program_id_, "scene_color"), 0 /*GL_TEXTURE0*/);
+            glUniform1i(glGetUniformLocation(resolve_program_id_, "scene_depth"), 1 /*GL_TEXTURE1*/);
+            glUseProgram(0);
+        }
+
+        void Cleanup() {
+            glBindVertexArray(0);
+            glUseProgram(0);
+            glDeleteBuffers(1, &vertex_buffer_object_);
+            glDeleteVertexArrays(1, &vertex_array_id_);
+            glDeleteProgram(hiz_program_id_);
+            glDeleteProgram(resolve_program_id_);
+            DeleteTargets();
+            glDeleteFramebuffers(1, &hiz_framebuffer_id_);
+        }
+
+        // follows the window, the scene and the pyramid are only reallocated
+        // when the size actually changed
+        void Resize(int width, int height) {
+            if (width == width_ && height == height_) {
+                return;
+            }
+            this->width_ = width;
+            this->height_ = height;
+            DeleteTargets();
+            CreateTargets();
+        }
+
+        // everything drawn between BindScene() and UnbindScene() can be
+        // reflected. warning: overrides viewport!!
+        void BindScene() {
+            framebuffer_scene_.Bind();
+        }
+
+        void UnbindScene() {
+            framebuffer_scene_.Unbind();
+        }
+
+        // reduces the scene depth into the min depth pyramid. warning:
+        // overrides viewport!!
+        void BuildHiZ() {
+            GlState().UseProgram(hiz_program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Disable(GL_BLEND);
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            glBindFramebuffer(GL_FRAMEBUFFER, hiz_framebuffer_id_);
+
+            // level 0 is a copy of the scene depth
+            GLint level_id = glGetUniformLocation(hiz_program_id_, "level");
+            GlState().BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, framebuffer_scene_.DepthTexture());
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, hiz_texture_id_, 0 /*level*/);
+            glViewport(0, 0, width_, height_);
+            glUniform1i(level_id, 0);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+            GlState().BindTexture(GL_TEXTURE1, GL_TEXTURE_2D, hiz_texture_id_);
+            GlState().ActiveTexture(GL_TEXTURE1);
+            for (int level = 1; level < levels_; level++) {
+                // read only the previous level while writing this one
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, hiz_texture_id_, level);
+                glViewport(0, 0, std::max(1, width_ >> level), std::max(1, height_ >> level));
+                glUniform1i(level_id, level);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+        }
+
+        // copies the scene color and depth into the bound framebuffer
+        void Resolve() {
+            GlState().UseProgram(resolve_program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Disable(GL_BLEND);
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            GlState().DepthFunc(GL_ALWAYS);
+
+            GlState().BindTexture(GL_TEXTURE0, GL_TEXTURE_2D, scene_color_id_);
+            GlState().BindTexture(GL_TEXTURE1, GL_TEXTURE_2D, framebuffer_scene_.DepthTexture());
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+        GLuint SceneColor() {
+            return scene_color_id_;
+        }
+
+        GLuint HiZ() {
+            return hiz_texture_id_;
+        }
+
+        int HiZLevels() {
+            return levels_;
+        }
+};
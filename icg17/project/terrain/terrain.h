@@ -1,52 +1,48 @@
 #pragma once
 #include "icg_helper.h"
 #include <glm/gtc/type_ptr.hpp>
+#include "../assets/asset_manager.h"
+#include "../uniforms/uniform_buffer.h"
+#include "../renderstate/renderstate.h"
+#include "../threading/job_system.h"
 
-struct Light {
-        glm::vec3 La = glm::vec3(1.0f, 1.0f, 1.0f);
-        glm::vec3 Ld = glm::vec3(1.0f, 1.0f, 1.0f);
-        glm::vec3 Ls = glm::vec3(1.0f, 1.0f, 1.0f);
+// height of the water plane in model space, the reflection is mirrored about it
+static const float WATER_LEVEL = 0.1322f;
 
-        glm::vec3 light_pos = glm::vec3(0.0f, 0.0f, 2.0f);
+// material textures are resampled to a common size to share one texture array
+static const int MATERIAL_SIZE = 1024;
+static const GLfloat MAX_ANISOTROPY = 8.0f;
 
-        // pass light properties to the shader
-        void Setup(GLuint program_id) {
-            glUseProgram(program_id);
+// cells on a side of the terrain grid, and grid rows built per job when the
+// grid is stored in buffers
+static const int GRID_DIM = 2048;
+static const int GRID_ROWS_PER_JOB = 64;
 
-            // given in camera space
-            GLuint light_pos_id = glGetUniformLocation(program_id, "light_pos");
-
-            GLuint La_id = glGetUniformLocation(program_id, "La");
-            GLuint Ld_id = glGetUniformLocation(program_id, "Ld");
-            GLuint Ls_id = glGetUniformLocation(program_id, "Ls");
-
-            glUniform3fv(light_pos_id, ONE, glm::value_ptr(light_pos));
-            glUniform3fv(La_id, ONE, glm::value_ptr(La));
-            glUniform3fv(Ld_id, ONE, glm::value_ptr(Ld));
-            glUniform3fv(Ls_id, ONE, glm::value_ptr(Ls));
-        }
-};
-
-class Terrain : public Light {
+class Terrain {
 
     private:
         GLuint vertex_array_id_;                // vertex array object
-        GLuint vertex_buffer_object_position_;  // memory buffer for positions
-        GLuint vertex_buffer_object_index_;     // memory buffer for indices
-        GLuint program_id_;                     // GLSL shader program ID
+        GLuint vertex_buffer_object_position_ = 0;  // memory buffer for positions
+        GLuint vertex_buffer_object_index_ = 0;     // memory buffer for indices
         GLuint num_indices_;                    // number of vertices to render
+        bool procedural_grid_;                  // positions from gl_VertexID, no buffers
+        GLuint program_id_;                     // GLSL shader program ID
+        GLuint depth_program_id_ = 0;           // positions only, for the depth pre-pass
+        GLint depth_model_id_;
+        GLuint gbuffer_program_id_ = 0;         // materials only, for the deferred lighting
+        GLint gbuffer_model_id_;
 
         //Textures
         GLuint heightmap_texture_id_;           // Heightmap texture
-        GLuint grass_texture_id_;   
-        GLuint rock_texture_id_;   
-        GLuint snow_texture_id_;   
-        GLuint seabed_texture_id_;   
-        GLuint sand_texture_id_;
-        GLuint water_texture_id_;
+        GLuint materials_texture_id_;           // grass, rock, seabed, sand, snow, water (shared)
+        GLuint splatmap_texture_id_;            // material weights, baked from the heightmap
         GLuint reflection_texture_id_;
         GLuint wave_heightmap_id_;
         GLuint wave_normalmap_id_;
+        GLuint scene_color_id_ = 0;             // screen space reflection inputs
+        GLuint scene_hiz_id_ = 0;
+        int hiz_levels_ = 1;
+        GLboolean useSSR = false;
 
         //Water drawing
         GLboolean isWater = false;
@@ -56,161 +52,193 @@ class Terrain : public Light {
         int fps;
         float quantum_time;
         int height_mat_size;
+        glm::mat4 reflection_mvp_;              // camera the mirror was rendered with
+
+        // uniform locations, resolved once the program is linked. view,
+        // projection, time and light come from the shared uniform blocks.
+        GLint model_id_;
+        GLint row_id_;
+        GLint col_id_;
+        GLint next_row_id_;
+        GLint next_col_id_;
+        GLint wave_blend_id_;
+        GLint reflection_mvp_id_;
+        GLint use_ssr_id_;
+        GLint hiz_levels_id_;
+
+        void BindShader(float time, const glm::mat4 &model = IDENTITY_MATRIX) {
+            glUniformMatrix4fv(model_id_, ONE, DONT_TRANSPOSE, glm::value_ptr(model));
+
+            // the two frames of the wave animation around 'time', blended so
+            // that the waves move smoothly at any frame rate. cell k of the
+            // atlas holds the waves at (k + 1) / fps s, the last one at 0 s.
+            float position = fmod(time, 1.0f) / quantum_time;
+            int whole = std::min(int(position), fps - 1);
+            int frame = (whole + fps - 1) % fps;
+            int next = (frame + 1) % fps;
+            glUniform1i(row_id_, frame / height_mat_size);
+            glUniform1i(col_id_, frame % height_mat_size);
+            glUniform1i(next_row_id_, next / height_mat_size);
+            glUniform1i(next_col_id_, next % height_mat_size);
+            glUniform1f(wave_blend_id_, position - whole);
+
+            glUniformMatrix4fv(reflection_mvp_id_, ONE, DONT_TRANSPOSE,
+                               glm::value_ptr(reflection_mvp_));
+            glUniform1i(use_ssr_id_, this->useSSR);
+            glUniform1i(hiz_levels_id_, hiz_levels_);
+        }
 
-        void BindShader(float time, GLuint program_id,
-                        const glm::mat4 &model = IDENTITY_MATRIX,
-                  const glm::mat4 &view = IDENTITY_MATRIX,
-                  const glm::mat4 &projection = IDENTITY_MATRIX) {
-
-            Light::Setup(program_id_);
-
-            // setup matrix stack
-            GLint model_id = glGetUniformLocation(program_id_,
-                                                  "model");
-            glUniformMatrix4fv(model_id, ONE, DONT_TRANSPOSE, glm::value_ptr(model));
-            GLint view_id = glGetUniformLocation(program_id_,
-                                                 "view");
-            glUniformMatrix4fv(view_id, ONE, DONT_TRANSPOSE, glm::value_ptr(view));
-            GLint projection_id = glGetUniformLocation(program_id_,
-                                                       "projection");
-            glUniformMatrix4fv(projection_id, ONE, DONT_TRANSPOSE,
-                               glm::value_ptr(projection));
-
-            glUniform1i(glGetUniformLocation(program_id_, "isWater"),
-                        this->isWater);
-            glUniform1i(glGetUniformLocation(program_id_, "isReflection"),
-                        this->isReflection);
-            
-            int frame = int(ceil(fmod(time, 1.0f) / quantum_time)) - 1;
-            //cout << frame << endl;
-            int row = frame / height_mat_size;
-            int col = int(fmod(frame, height_mat_size));
+        // the material textures are the layers of one mipmapped texture array,
+        // shared by all the terrains; it only needs anisotropic filtering
+        void setupMaterials(GLuint texture_id, const char* shaderTextureName,
+                            GLuint gl_texture_id) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+            if(GLEW_EXT_texture_filter_anisotropic) {
+                GLfloat max_anisotropy;
+                glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy);
+                glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                                std::min(max_anisotropy, MAX_ANISOTROPY));
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            GLuint tex_id = glGetUniformLocation(program_id_, shaderTextureName);
+            glUniform1i(tex_id, GLuint(gl_texture_id - GL_TEXTURE0));
+        }
 
-            // pass the current time stamp to the shader.
-            glUniform1f(glGetUniformLocation(program_id_, "time"), time);
-            glUniform1i(glGetUniformLocation(program_id_, "row"), row);
-            glUniform1i(glGetUniformLocation(program_id_, "col"), col);
+        void activateTexture(GLuint texture_id, GLuint gl_texture_id) {
+            GlState().BindTexture(gl_texture_id, GL_TEXTURE_2D, texture_id);
+        }
 
-            glUniform1i(glGetUniformLocation(program_id_, "height_mat_size"), height_mat_size);
+        // rows [row_begin, row_end) of the (GRID_DIM + 1)^2 vertices spanning
+        // [-1, 1]^2, two floats each
+        static void GridVertices(int row_begin, int row_end, GLfloat* vertices) {
+            const float resolution = 2.0f / GRID_DIM;
+            for (int i = row_begin; i < row_end; i++) {
+                GLfloat* vertex = vertices + 2 * size_t(i) * (GRID_DIM + 1);
+                for (int j = 0; j <= GRID_DIM; j++) {
+                    vertex[0] = (j - GRID_DIM / 2) * resolution;
+                    vertex[1] = (i - GRID_DIM / 2) * resolution;
+                    vertex += 2;
+                }
+            }
         }
 
-        void loadTexture(const string file, GLuint* texture_id, const char* shaderTextureName, GLuint gl_texture_id) {
-            int width;
-            int height;
-            int nb_component;
-            string filename = "../../textures/"+file;
-            // set stb_image to have the same coordinates as OpenGL
-            stbi_set_flip_vertically_on_load(1);
-            unsigned char* image = stbi_load(filename.c_str(), &width,
-                                             &height, &nb_component, 0);
-
-            if(image == nullptr) {
-                throw(string("Failed to load texture"));
+        // the two triangles of every cell of rows [row_begin, row_end)
+        static void GridIndices(int row_begin, int row_end, GLuint* indices) {
+            for (int i = row_begin; i < row_end; i++) {
+                GLuint* index = indices + 6 * size_t(i) * GRID_DIM;
+                for (int j = 0; j < GRID_DIM; j++) {
+                    GLuint corner = j + (GRID_DIM + 1) * i;
+                    index[0] = corner;
+                    index[1] = corner + 1;
+                    index[2] = corner + GRID_DIM + 1;
+                    index[3] = corner + 1;
+                    index[4] = corner + GRID_DIM + 1;
+                    index[5] = corner + GRID_DIM + 2;
+                    index += 6;
+                }
             }
+        }
 
-            glGenTextures(1, texture_id);
-            glBindTexture(GL_TEXTURE_2D, *texture_id);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-            if(nb_component == 3) {
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
-                             GL_RGB, GL_UNSIGNED_BYTE, image);
-            } else if(nb_component == 4) {
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
-                             GL_RGBA, GL_UNSIGNED_BYTE, image);
+        // allocates 'count' elements in the buffer bound to 'target' and has
+        // 'fill(begin, end, data)' write 'rows' of them in parallel, straight
+        // into the mapped buffer
+        template <typename T, typename Fill>
+        static void FillBuffer(GLenum target, size_t count, int rows, JobSystem &jobs,
+                               Fill fill) {
+            GLsizeiptr bytes = GLsizeiptr(count * sizeof(T));
+            glBufferData(target, bytes, NULL, GL_STATIC_DRAW);
+            T* data = (T*) glMapBufferRange(target, 0, bytes,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (data) {
+                jobs.ParallelFor(0, rows, GRID_ROWS_PER_JOB, [&](int begin, int end) {
+                    fill(begin, end, data);
+                });
+                if (glUnmapBuffer(target)) {
+                    return;
+                }
             }
 
-            GLuint tex_id = glGetUniformLocation(program_id_, shaderTextureName);
-            glUniform1i(tex_id, GLuint(gl_texture_id - GL_TEXTURE0));
-            // cleanup
-            glBindTexture(GL_TEXTURE_2D, gl_texture_id);
-            stbi_image_free(image);
+            // no mapping, or its content was lost: through a copy
+            vector<T> copy(count);
+            jobs.ParallelFor(0, rows, GRID_ROWS_PER_JOB, [&](int begin, int end) {
+                fill(begin, end, &copy[0]);
+            });
+            glBufferSubData(target, 0, bytes, &copy[0]);
         }
 
-        void activateTexture(GLuint texture_id, GLuint gl_texture_id) {
-            glActiveTexture(gl_texture_id);
-            glBindTexture(GL_TEXTURE_2D, texture_id);
+        void DrawGrid() {
+            if (procedural_grid_) {
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 2 * (GRID_DIM + 1), GRID_DIM);
+            } else {
+                glDrawElements(GL_TRIANGLES, num_indices_, GL_UNSIGNED_INT, 0);
+            }
         }
 
     public:
         void Init(float heightmap_width, float heightmap_height, GLuint heightMap, 
+                                                                 GLuint splatMap,
                                                                  GLuint reflection, 
                                                                  GLuint waveheight, 
                                                                  GLuint wavenormal, 
                                                                  GLboolean isWater, 
                                                                  GLboolean isReflection,
-                                                                 GLuint fps) {
+                                                                 GLuint fps,
+                                                                 AssetManager &assets,
+                                                                 JobSystem &jobs,
+                                                                 bool procedural_grid = true) {
             // set heightmap size
             this->heightmap_width_ = heightmap_width;
             this->heightmap_height_ = heightmap_height;
-
-            // compile the shaders.
+            this->procedural_grid_ = procedural_grid;
+
+            // compile the shaders, specialized for the role of this terrain
+            // and for where its grid comes from.
+            vector<string> defines;
+            if(isWater) {
+                defines.push_back("WATER");
+            } else if(isReflection) {
+                defines.push_back("REFLECTION");
+            }
+            if(!procedural_grid) {
+                defines.push_back("GRID_BUFFER");
+            }
             program_id_ = icg_helper::LoadShaders("terrain_vshader.glsl",
-                                                  "terrain_fshader.glsl");
+                                                  "terrain_fshader.glsl", defines);
             if(!program_id_) {
                 exit(EXIT_FAILURE);
             }
 
             glUseProgram(program_id_);
 
-            // vertex one vertex array
+            // the vertex shader computes the grid positions from the vertex
+            // and instance ids, the vertex array only has to be bound. or the
+            // grid is stored: GRID_DIM x GRID_DIM cells reaching from [-1, -1]
+            // to [1, 1], built in parallel straight into the buffers.
             glGenVertexArrays(1, &vertex_array_id_);
-            glBindVertexArray(vertex_array_id_);
-
-            // vertex coordinates and indices
-            {
-                std::vector<GLfloat> vertices;
-                std::vector<GLuint> indices;
-                // TODO 5: make a triangle grid with dimension 100x100.
-                // always two subsequent entries in 'vertices' form a 2D vertex position.
-                int grid_dim = 2048;
-
-                // the given code below are the vertices for a simple quad.
-                // your grid should have the same dimension as that quad, i.e.,
-                // reach from [-1, -1] to [1, 1].
-
-                // vertex position of the triangles.
-                
-                float resolution = 2.0f / grid_dim;
-                
-                for (float i = (float)(-grid_dim / 2); i <= grid_dim / 2; i += 1.0f) {
-                    for (float j = (float)(-grid_dim / 2); j <= grid_dim / 2; j += 1.0f) {
-                        vertices.push_back(j * resolution); vertices.push_back(i * resolution);
-                    }
-                }
-                
-                // and indices.
-                for (int i = 0; i < grid_dim; i++) {
-                    for (int j = 0; j < grid_dim; j++) {
-                        indices.push_back(j + (grid_dim + 1) * i);
-                        indices.push_back(j + (grid_dim + 1) * i + 1);
-                        indices.push_back(j + (grid_dim + 1) * (i + 1));
-                        indices.push_back(j + (grid_dim + 1) * i + 1);
-                        indices.push_back(j + (grid_dim + 1) * (i + 1));
-                        indices.push_back(j + (grid_dim + 1) * (i + 1) + 1);
-                    }
-                }
-
-                num_indices_ = indices.size();
+            glUniform1i(glGetUniformLocation(program_id_, "grid_dim"), GRID_DIM);
+            if(!procedural_grid) {
+                glBindVertexArray(vertex_array_id_);
+                num_indices_ = 6 * GRID_DIM * GRID_DIM;
 
                 // position buffer
                 glGenBuffers(1, &vertex_buffer_object_position_);
                 glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object_position_);
-                glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
-                             &vertices[0], GL_STATIC_DRAW);
+                FillBuffer<GLfloat>(GL_ARRAY_BUFFER, 2 * size_t(GRID_DIM + 1) * (GRID_DIM + 1),
+                                    GRID_DIM + 1, jobs, GridVertices);
 
                 // vertex indices
                 glGenBuffers(1, &vertex_buffer_object_index_);
                 glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vertex_buffer_object_index_);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
-                             &indices[0], GL_STATIC_DRAW);
+                FillBuffer<GLuint>(GL_ELEMENT_ARRAY_BUFFER, size_t(num_indices_), GRID_DIM,
+                                   jobs, GridIndices);
 
-                // position shader attribute
-                GLuint loc_position = glGetAttribLocation(program_id_, "position");
+                // 'position' has an explicit location shared by all the programs
+                GLuint loc_position = 0;
                 glEnableVertexAttribArray(loc_position);
                 glVertexAttribPointer(loc_position, 2, GL_FLOAT, DONT_NORMALIZE,
                                       ZERO_STRIDE, ZERO_BUFFER_OFFSET);
+                glBindVertexArray(0);
             }
 
             this->isWater = isWater;
@@ -228,12 +256,14 @@ class Terrain : public Light {
 
             
             // Load/assign texures
-            loadTexture("grass.tga", &grass_texture_id_, "GrassTex2D", GL_TEXTURE1);
-            loadTexture("rock.tga", &rock_texture_id_, "RockTex2D", GL_TEXTURE2);
-            loadTexture("seabed.tga", &seabed_texture_id_, "SeabedTex2D", GL_TEXTURE3);
-            loadTexture("sand.tga", &sand_texture_id_, "SandTex2D", GL_TEXTURE4);
-            loadTexture("snow.tga", &snow_texture_id_, "SnowTex2D", GL_TEXTURE5);
-            loadTexture("water.tga", &water_texture_id_, "WaterTex2D", GL_TEXTURE6);
+            const vector<string> materials = { "grass.tga", "rock.tga", "seabed.tga",
+                                               "sand.tga", "snow.tga", "water.tga" };
+            materials_texture_id_ = assets.RequestTextureArray(materials, MATERIAL_SIZE);
+            setupMaterials(materials_texture_id_, "Materials", GL_TEXTURE1);
+
+            this->splatmap_texture_id_ = splatMap;
+            GLuint splatmap_id = glGetUniformLocation(program_id_, "splatMap");
+            glUniform1i(splatmap_id, 2 /*GL_TEXTURE2*/);
 
             // REFLECTION CODE
             this->reflection_texture_id_ = reflection;
@@ -252,11 +282,75 @@ class Terrain : public Light {
             glUniform1i(wavenormal_id, 9 /*GL_TEXTURE9*/);
             glBindTexture(GL_TEXTURE_2D, GL_TEXTURE9);
 
+            glUniform1i(glGetUniformLocation(program_id_, "scene_color"), 10 /*GL_TEXTURE10*/);
+            glUniform1i(glGetUniformLocation(program_id_, "scene_hiz"), 11 /*GL_TEXTURE11*/);
+
             quantum_time = 1.0f/float(fps);
             height_mat_size = int(ceil(sqrt(float(fps))));
 
+            // uniforms that never change
+            glUniform1f(glGetUniformLocation(program_id_, "heightmap_width"),
+                        this->heightmap_width_);
+            glUniform1f(glGetUniformLocation(program_id_, "heightmap_height"),
+                        this->heightmap_height_);
+            glUniform1i(glGetUniformLocation(program_id_, "height_mat_size"), height_mat_size);
+            // keep only what lies above the water, in model space
+            glUniform4f(glGetUniformLocation(program_id_, "clip_plane"),
+                        0.0f, 1.0f, 0.0f, -WATER_LEVEL);
+            BindUniformBlock(program_id_, "Frame", FRAME_UNIFORMS_BINDING);
+            BindUniformBlock(program_id_, "Light", LIGHT_UNIFORMS_BINDING);
+
+            // and those changing per draw
+            model_id_ = glGetUniformLocation(program_id_, "model");
+            row_id_ = glGetUniformLocation(program_id_, "row");
+            col_id_ = glGetUniformLocation(program_id_, "col");
+            next_row_id_ = glGetUniformLocation(program_id_, "next_row");
+            next_col_id_ = glGetUniformLocation(program_id_, "next_col");
+            wave_blend_id_ = glGetUniformLocation(program_id_, "wave_blend");
+            reflection_mvp_id_ = glGetUniformLocation(program_id_, "reflection_mvp");
+            use_ssr_id_ = glGetUniformLocation(program_id_, "useSSR");
+            hiz_levels_id_ = glGetUniformLocation(program_id_, "hiz_levels");
+
+            // the plain terrain can lay its depth down first, with a program
+            // only computing the positions
+            if(!isWater && !isReflection) {
+                depth_program_id_ = icg_helper::LoadShaders("terrain_vshader.glsl",
+                                                            "terrain_depth_fshader.glsl",
+                                                            defines);
+                if(!depth_program_id_) {
+                    exit(EXIT_FAILURE);
+                }
+                glUseProgram(depth_program_id_);
+                glUniform1i(glGetUniformLocation(depth_program_id_, "heightMap"), 0);
+                glUniform1i(glGetUniformLocation(depth_program_id_, "grid_dim"), GRID_DIM);
+                BindUniformBlock(depth_program_id_, "Frame", FRAME_UNIFORMS_BINDING);
+                BindUniformBlock(depth_program_id_, "Light", LIGHT_UNIFORMS_BINDING);
+                depth_model_id_ = glGetUniformLocation(depth_program_id_, "model");
+
+                // and write its materials to the G-buffer, see DeferredShading
+                vector<string> gbuffer_defines = defines;
+                gbuffer_defines.push_back("GBUFFER");
+                gbuffer_program_id_ = icg_helper::LoadShaders("terrain_vshader.glsl",
+                                                              "terrain_fshader.glsl",
+                                                              gbuffer_defines);
+                if(!gbuffer_program_id_) {
+                    exit(EXIT_FAILURE);
+                }
+                glUseProgram(gbuffer_program_id_);
+                glUniform1i(glGetUniformLocation(gbuffer_program_id_, "heightMap"), 0);
+                glUniform1i(glGetUniformLocation(gbuffer_program_id_, "Materials"), 1);
+                glUniform1i(glGetUniformLocation(gbuffer_program_id_, "splatMap"), 2);
+                glUniform1i(glGetUniformLocation(gbuffer_program_id_, "grid_dim"), GRID_DIM);
+                glUniform1f(glGetUniformLocation(gbuffer_program_id_, "heightmap_width"),
+                            this->heightmap_width_);
+                glUniform1f(glGetUniformLocation(gbuffer_program_id_, "heightmap_height"),
+                            this->heightmap_height_);
+                BindUniformBlock(gbuffer_program_id_, "Frame", FRAME_UNIFORMS_BINDING);
+                BindUniformBlock(gbuffer_program_id_, "Light", LIGHT_UNIFORMS_BINDING);
+                gbuffer_model_id_ = glGetUniformLocation(gbuffer_program_id_, "model");
+            }
+
             // to avoid the current object being polluted
-            glBindVertexArray(0);
             glUseProgram(0);
         }
 
@@ -266,59 +360,90 @@ class Terrain : public Light {
             glDeleteBuffers(1, &vertex_buffer_object_position_);
             glDeleteBuffers(1, &vertex_buffer_object_index_);
             glDeleteVertexArrays(1, &vertex_array_id_);
-            glDeleteProgram(program_id_);
+            icg_helper::ReleaseShaders(program_id_);
+            if(depth_program_id_) {
+                icg_helper::ReleaseShaders(depth_program_id_);
+            }
+            if(gbuffer_program_id_) {
+                icg_helper::ReleaseShaders(gbuffer_program_id_);
+            }
             glDeleteTextures(1, &heightmap_texture_id_);
-            glDeleteTextures(1, &grass_texture_id_);
-            glDeleteTextures(1, &rock_texture_id_);
-            glDeleteTextures(1, &snow_texture_id_);
-            glDeleteTextures(1, &seabed_texture_id_);
-            glDeleteTextures(1, &sand_texture_id_);
-            glDeleteTextures(1, &water_texture_id_);
             glDeleteTextures(1, &reflection_texture_id_);
             glDeleteTextures(1, &wave_heightmap_id_);
             glDeleteTextures(1, &wave_normalmap_id_);
         }
 
+        // the water samples the mirror texture through the camera it was
+        // rendered with, so that a cached mirror is reprojected
+        void SetReflectionViewProjection(const glm::mat4 &mvp) {
+            this->reflection_mvp_ = mvp;
+        }
+
+        // reflect the scene in screen space instead of through the mirror
+        // texture, which then only needs to hold the sky
+        void SetScreenSpaceReflection(GLboolean enabled, GLuint scene_color = 0,
+                                      GLuint scene_hiz = 0, int hiz_levels = 1) {
+            this->useSSR = enabled;
+            this->scene_color_id_ = scene_color;
+            this->scene_hiz_id_ = scene_hiz;
+            this->hiz_levels_ = hiz_levels;
+        }
+
+        // writes only the depth of the terrain, so that Draw() then shades
+        // every pixel once instead of once per layer of hills. plain terrain
+        // only, the color writes are enabled again afterwards.
+        void DrawDepth(const glm::mat4 &model = IDENTITY_MATRIX) {
+            GlState().Disable(GL_CLIP_DISTANCE0);
+            GlState().UseProgram(depth_program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().DepthFunc(GL_LESS);
+            glUniformMatrix4fv(depth_model_id_, ONE, DONT_TRANSPOSE, glm::value_ptr(model));
+            activateTexture(heightmap_texture_id_, GL_TEXTURE0);
+
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            DrawGrid();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+
+        // view and projection come from the frame uniform block. after
+        // DrawDepth(), only the fragments on the laid down depth are shaded.
+        // 'gbuffer': write the materials to the bound G-buffer rather than
+        // lighting them, plain terrain only.
         void Draw(float time, const glm::mat4 &model = IDENTITY_MATRIX,
-                  const glm::mat4 &view = IDENTITY_MATRIX,
-                  const glm::mat4 &projection = IDENTITY_MATRIX) {
-            
-            if (isReflection) {
-                glDisable(GL_DEPTH_TEST);
-            }
-            glUseProgram(program_id_);
-            glBindVertexArray(vertex_array_id_);
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                  bool depth_drawn = false, bool gbuffer = false) {
+
+            // the model matrix is already mirrored for the reflection, submerged
+            // terrain is clipped before rasterization. only the water is
+            // translucent.
+            GlState().Set(GL_CLIP_DISTANCE0, isReflection);
+            GlState().UseProgram(gbuffer ? gbuffer_program_id_ : program_id_);
+            GlState().BindVertexArray(vertex_array_id_);
+            GlState().Set(GL_BLEND, isWater);
+            GlState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            GlState().DepthFunc(depth_drawn ? GL_EQUAL : GL_LESS);
 
             //Setup up for shading
-            BindShader(time, program_id_, model, view, projection);
-
-            // window size uniforms
-            glUniform1f(glGetUniformLocation(program_id_, "heightmap_width"),
-                        this->heightmap_width_);
-            glUniform1f(glGetUniformLocation(program_id_, "heightmap_height"),
-                        this->heightmap_height_);
+            if (gbuffer) {
+                glUniformMatrix4fv(gbuffer_model_id_, ONE, DONT_TRANSPOSE,
+                                   glm::value_ptr(model));
+            } else {
+                BindShader(time, model);
+            }
 
+            // only the textures the permutation samples
             activateTexture(heightmap_texture_id_, GL_TEXTURE0);
-            activateTexture(grass_texture_id_, GL_TEXTURE1);
-            activateTexture(rock_texture_id_, GL_TEXTURE2);
-            activateTexture(seabed_texture_id_, GL_TEXTURE3);
-            activateTexture(sand_texture_id_, GL_TEXTURE4);
-            activateTexture(snow_texture_id_, GL_TEXTURE5);
-            activateTexture(water_texture_id_, GL_TEXTURE6);
-            activateTexture(reflection_texture_id_, GL_TEXTURE7);
-            activateTexture(wave_heightmap_id_, GL_TEXTURE8);
-            activateTexture(wave_normalmap_id_, GL_TEXTURE9);
+            if (isWater) {
+                activateTexture(reflection_texture_id_, GL_TEXTURE7);
+                activateTexture(wave_heightmap_id_, GL_TEXTURE8);
+                activateTexture(wave_normalmap_id_, GL_TEXTURE9);
+                activateTexture(scene_color_id_, GL_TEXTURE10);
+                activateTexture(scene_hiz_id_, GL_TEXTURE11);
+            } else {
+                GlState().BindTexture(GL_TEXTURE1, GL_TEXTURE_2D_ARRAY, materials_texture_id_);
+                activateTexture(splatmap_texture_id_, GL_TEXTURE2);
+            }
 
             //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glDrawElements(GL_TRIANGLES, num_indices_, GL_UNSIGNED_INT, 0);
-
-            if (isReflection) {
-                glEnable(GL_DEPTH_TEST);
-            }
-            glDisable(GL_BLEND);
-            glBindVertexArray(0);
-            glUseProgram(0);
+            DrawGrid();
         }
 };
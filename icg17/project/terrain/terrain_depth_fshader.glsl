@@ -0,0 +1,5 @@
+#version 330
+// the depth pre-pass of the terrain (see Terrain::DrawDepth), depth only
+
+void main() {
+}
@@ -1,69 +1,103 @@
 #version 330
+// compiled once per role (see Terrain): WATER, REFLECTION or the plain terrain,
+// which with GBUFFER writes its materials for the deferred lighting instead
 
 in vec2 texture_coordinates;
 in vec4 vpoint_mv;
 in vec3 light_dir, view_dir;
 in vec3 wavenormal_vec;
 in mat4 mv;
+in vec4 reflection_clip;
 
-uniform vec3 La, Ld, Ls;
-uniform bool isWater;
-uniform bool isReflection;
 uniform float heightmap_width;
 uniform float heightmap_height;
-uniform int row;
-uniform int col;
-uniform int height_mat_size;
 
 //Texures
 uniform sampler2D heightMap;
-uniform sampler2D waveheight;
-uniform sampler2D wavenormal;
-uniform sampler2D GrassTex2D;
-uniform sampler2D RockTex2D;
-uniform sampler2D SeabedTex2D;
-uniform sampler2D SandTex2D;
-uniform sampler2D SnowTex2D;
-uniform sampler2D WaterTex2D;
+
+#ifdef WATER
+uniform int row;
+uniform int col;
+uniform int height_mat_size;
 uniform sampler2D reflection;
 
+// screen space reflections
+uniform bool useSSR;
+uniform sampler2D scene_color;
+uniform sampler2D scene_hiz;
+uniform int hiz_levels;
+#else
+uniform sampler2DArray Materials;
+uniform sampler2D splatMap;
+#endif
+
+// shared by all the programs, see uniforms/uniform_buffer.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
+layout(std140) uniform Light {
+    vec3 La, Ld, Ls;
+    vec3 light_pos;
+};
+
+#ifdef GBUFFER
+// see deferred/deferred.h
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec2 normal_oct;
+#else
 out vec4 color;
+#endif
 
-/*************
-SAND values
-**************/
-vec3 sandKa = texture(SandTex2D, 30.0*texture_coordinates).rgb;
-vec3 sandKd = vec3(0.2f, 0.2f, 0.2f);
-vec3 sandKs = vec3(0.0f, 0.0f, 0.0f);
-
-/*************
-GRASS values
-**************/
-vec3 grassKa = texture(GrassTex2D, 50.0*texture_coordinates).rgb;
-vec3 grassKd = vec3(0.15f, 0.15f, 0.15f);
-vec3 grassKs = vec3(0.0f, 0.0f, 0.0f);
+// layers of the Materials texture array
+const float GRASS_LAYER = 0.0f;
+const float ROCK_LAYER = 1.0f;
+const float SEABED_LAYER = 2.0f;
+const float SAND_LAYER = 3.0f;
+const float SNOW_LAYER = 4.0f;
+const float WATER_LAYER = 5.0f;
 
+#ifndef WATER
 /*************
-ROCK values
+LAND materials, in the order of the splat map channels
+(sand, grass, rock, snow, then the seabed)
 **************/
-vec3 rockKa = texture(RockTex2D, 30.0*texture_coordinates).rgb;
-vec3 rockKd = vec3(0.2f, 0.2f, 0.2f);
-vec3 rockKs = vec3(0.0f, 0.0f, 0.00f);
-
-/*************
-SNOW values
-**************/
-vec3 snowKa = texture(SnowTex2D, texture_coordinates).rgb;
-vec3 snowKd = vec3(0.2f, 0.2f, 0.2f);
-vec3 snowKs = vec3(0.2f, 0.2f, 0.2f);
+const int NUM_MATERIALS = 5;
+const float materialLayer[NUM_MATERIALS] = float[](SAND_LAYER, GRASS_LAYER, ROCK_LAYER,
+                                                   SNOW_LAYER, SEABED_LAYER);
+const float materialTiling[NUM_MATERIALS] = float[](30.0f, 50.0f, 30.0f, 1.0f, 10.0f);
+const vec3 materialKd[NUM_MATERIALS] = vec3[](vec3(0.2f), vec3(0.15f), vec3(0.2f),
+                                              vec3(0.2f), vec3(0.2f));
+const vec3 materialKs[NUM_MATERIALS] = vec3[](vec3(0.0f), vec3(0.0f), vec3(0.0f),
+                                              vec3(0.2f), vec3(0.0f));
+
+// below this, a weight is only the rounding of the 8 bit splat map
+const float minWeight = 1.5f / 255.0f;
+#endif
+
+#ifdef GBUFFER
+// the G-buffer keeps Kd and Ks (grey) in 4 bits each, up to this.
+// keep in sync with deferred/lighting_fshader.glsl
+const float materialKMax = 0.25f;
+
+// a unit vector folded onto the octahedron, in [0, 1]^2
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0) {
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return e * 0.5 + 0.5;
+}
+#endif
 
 /*************
-Seabed values
+CONSTANT values
 **************/
-vec3 seaBedKa = texture(SeabedTex2D, 10.0*texture_coordinates).rgb;
-vec3 seaBedKd = vec3(0.2f, 0.2f, 0.2f);
-vec3 seaBedKs = vec3(0.0f, 0.0f, 0.0f);
+const float default_alpha = 60.0f;
 
+#ifdef WATER
 /*************
 WATER COLOR
 **************/
@@ -71,149 +105,199 @@ vec3 waterKa = vec3(0.0f, 0.3f, 0.3f);
 vec3 waterKd = vec3(0.0f, 0.31f, 0.31f);
 vec3 waterKs = vec3(0.0f, 0.0f, 0.0f);
 
-/*************
-CONSTANT values
-**************/
-const float default_alpha = 60.0f;
 const float sandMin = 0.130f;
-const float seadBedMax = 0.120f;
-const float forestMin = 0.135f;
-const float snowMin = 0.26f;
-const float rockMin = 0.18f;
-const float epsilon = 0.02f;
+
+const int ssr_max_iterations = 64;
+const float ssr_near = 0.01f;
+const float ssr_max_distance = 10.0f;
 
 vec3 getWaterColor(float percentageDarkBlue) {
     return mix(waterKa, vec3(0.0f, 0.0f, 0.0f), vec3(percentageDarkBlue));
 }
 
+// screen position (uv, depth) of a view space point
+vec3 toScreen(vec3 point) {
+    vec4 clip = projection * vec4(point, 1.0);
+    return (clip.xyz / clip.w) * 0.5 + 0.5;
+}
+
+// marches a view space ray through the min depth pyramid of the scene, which
+// skips whole cells the ray passes in front of. returns the screen uv of the
+// hit, or vec2(-1) when the ray leaves the screen.
+vec2 traceScreenSpace(vec3 origin, vec3 direction) {
+    // stop the ray at the near plane so that its projection stays valid
+    float ray_length = ssr_max_distance;
+    if (origin.z + direction.z * ray_length > -ssr_near) {
+        ray_length = (-ssr_near - origin.z) / direction.z;
+    }
+    vec3 start = toScreen(origin);
+    vec3 ray = toScreen(origin + direction * ray_length) - start;
+
+    // half a pixel, in ray parameter units
+    vec2 base_size = vec2(textureSize(scene_hiz, 0));
+    float t_bias = 0.5 / max(length(ray.xy * base_size), 1.0);
+    vec2 inv_ray = vec2(abs(ray.x) > 1e-6 ? 1.0 / ray.x : 1e6,
+                        abs(ray.y) > 1e-6 ? 1.0 / ray.y : 1e6);
+
+    int level = 0;
+    float t = 2.0 * t_bias; // leave the water pixel itself
+    for (int i = 0; i < ssr_max_iterations; i++) {
+        vec3 p = start + ray * t;
+        if (t > 1.0 || any(lessThan(p.xy, vec2(0.0))) || any(greaterThan(p.xy, vec2(1.0)))) {
+            break;
+        }
+
+        vec2 size = vec2(textureSize(scene_hiz, level));
+        vec2 cell = floor(p.xy * size);
+        float min_depth = texelFetch(scene_hiz, ivec2(cell), level).r;
+
+        // ray parameters where it leaves the cell, and where it gets behind
+        // the nearest surface of the cell
+        vec2 boundary = (cell + step(0.0, ray.xy)) / size;
+        vec2 t_cell = (boundary - start.xy) * inv_ray;
+        float t_exit = min(t_cell.x, t_cell.y);
+        float t_depth = t;
+        if (p.z < min_depth) {
+            t_depth = ray.z > 0.0 ? (min_depth - start.z) / ray.z : 2.0;
+        }
+
+        if (t_depth > t_exit) {
+            // in front of the whole cell: skip it and try a coarser one
+            t = t_exit + t_bias;
+            level = min(level + 1, hiz_levels - 1);
+        } else if (level == 0) {
+            return (start + ray * t_depth).xy;
+        } else {
+            // may hit inside this cell: move onto its nearest surface and refine
+            t = t_depth;
+            level--;
+        }
+    }
+    return vec2(-1.0);
+}
+
+// color reflected by the water. the mirror texture holds the whole reflection,
+// or only the sky when the scene is reflected in screen space.
+vec3 getReflection(vec2 mirror_uv, vec3 normal_mv) {
+    vec3 mirrored = texture(reflection, mirror_uv).rgb;
+    if (!useSSR) {
+        return mirrored;
+    }
+
+    vec3 direction = reflect(normalize(vpoint_mv.xyz), normal_mv);
+    vec2 hit = traceScreenSpace(vpoint_mv.xyz, direction);
+    if (hit.x < 0.0) {
+        return mirrored;
+    }
+
+    // fade out towards the screen borders, where rays start to miss
+    vec2 border = abs(hit * 2.0 - 1.0);
+    float fade = 1.0 - smoothstep(0.8, 1.0, max(border.x, border.y));
+    return mix(mirrored, texture(scene_color, hit).rgb, fade);
+}
+#endif
+
 void main() {
     float height = texture(heightMap, texture_coordinates).r;
 
-    float window_width = textureSize(reflection, 0).x;
-    float window_height = textureSize(reflection, 0).y;
-    float _u = gl_FragCoord.x/window_width;
-    float _v = gl_FragCoord.y/window_height;
-
     vec3 ambiant;
     vec3 diffuse;
     vec3 specular;
 
-    if(isWater) {
-        vec3 mirrornormal = vec3(0,0,1);
-        vec3 x = dFdx(vpoint_mv).xyz;
-        vec3 y = dFdy(vpoint_mv).xyz;
-        vec3 normal_mv = normalize(cross(x,y));
-        vec3 r = normalize(2*normal_mv*(max(0.0f, dot(normal_mv,light_dir))) - light_dir);
-
-        vec2 uv = fract(texture_coordinates / vec2(1.0f,1.0f));
-        //vec2 new_uv = uv;
-        vec2 new_uv = (uv / float(height_mat_size)) + ((1.0f/float(height_mat_size)) * vec2(col, row));
-
-        ambiant = waterKa * La;
-        diffuse = waterKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
-        specular = waterKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
-
-        vec3 flatnormal = wavenormal_vec - dot(wavenormal_vec, mirrornormal) * mirrornormal;
-        vec3 eyenormal = transpose(inverse(mat3(mv))) * flatnormal;
-        vec2 offset = normalize(eyenormal.xy) * length(flatnormal) * 0.1;
-
-        if(height >= sandMin && height <= sandMin + 0.005) {
-            float waterPerc = 0.8f - 0.8f * ((height - (sandMin)) / 0.005f);
-            color = vec4(mix(ambiant + diffuse + specular, texture(reflection,vec2(_u,_v) + offset).rgb, 0.7), waterPerc);
-        } else if (height < sandMin){
-            height = max(0.0f, height);
-            float percentageDarkBlue = (sandMin-height)/sandMin;
-            ambiant = getWaterColor(percentageDarkBlue) * La;
-            color = vec4(mix(ambiant + diffuse + specular, texture(reflection,vec2(_u,_v) + offset).rgb, 0.7), 0.8f);
-        } else {
-            color = vec4(1.0f, 1.0f, 1.0f, 0.0f);
-        }
+#ifdef WATER
+    // where the mirror saw this point, equal to the fragment position unless
+    // the mirror is reused from an earlier camera
+    vec2 mirror_uv = (reflection_clip.xy / reflection_clip.w) * 0.5 + 0.5;
+
+    vec3 mirrornormal = vec3(0,0,1);
+    vec3 x = dFdx(vpoint_mv).xyz;
+    vec3 y = dFdy(vpoint_mv).xyz;
+    vec3 normal_mv = normalize(cross(x,y));
+    vec3 r = normalize(2*normal_mv*(max(0.0f, dot(normal_mv,light_dir))) - light_dir);
+    vec3 facing_normal_mv = dot(normal_mv, vpoint_mv.xyz) > 0.0 ? -normal_mv : normal_mv;
+
+    vec2 uv = fract(texture_coordinates / vec2(1.0f,1.0f));
+    //vec2 new_uv = uv;
+    vec2 new_uv = (uv / float(height_mat_size)) + ((1.0f/float(height_mat_size)) * vec2(col, row));
+
+    ambiant = waterKa * La;
+    diffuse = waterKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
+    specular = waterKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
+
+    vec3 flatnormal = wavenormal_vec - dot(wavenormal_vec, mirrornormal) * mirrornormal;
+    vec3 eyenormal = transpose(inverse(mat3(mv))) * flatnormal;
+    vec2 offset = normalize(eyenormal.xy) * length(flatnormal) * 0.1;
+    vec3 reflected = getReflection(mirror_uv + offset, facing_normal_mv);
+
+    if(height >= sandMin && height <= sandMin + 0.005) {
+        float waterPerc = 0.8f - 0.8f * ((height - (sandMin)) / 0.005f);
+        color = vec4(mix(ambiant + diffuse + specular, reflected, 0.7), waterPerc);
+    } else if (height < sandMin){
+        height = max(0.0f, height);
+        float percentageDarkBlue = (sandMin-height)/sandMin;
+        ambiant = getWaterColor(percentageDarkBlue) * La;
+        color = vec4(mix(ambiant + diffuse + specular, reflected, 0.7), 0.8f);
     } else {
-        vec2 x1_temp = vec2(texture_coordinates.x-(1.0/heightmap_width), texture_coordinates.y);
-        vec2 x2_temp = vec2(texture_coordinates.x+(1.0/heightmap_width), texture_coordinates.y);
-
-        vec3 x1 = vec3(x1_temp, texture(heightMap, x1_temp).r);
-        vec3 x2 = vec3(x2_temp, texture(heightMap, x2_temp).r);
-
-        vec2 y1_temp = vec2(texture_coordinates.x, texture_coordinates.y-(1.0/heightmap_height));
-        vec2 y2_temp = vec2(texture_coordinates.x, texture_coordinates.y+(1.0/heightmap_height));
-
-        vec3 y1 = vec3(y1_temp, texture(heightMap, y1_temp).r);
-        vec3 y2 = vec3(y2_temp, texture(heightMap, y2_temp).r);
-
-        vec3 x = normalize(x2-x1);
-        vec3 y = normalize(y2-y1);
-        vec3 normal_mv = normalize(cross(x,y));
-        vec3 r = normalize(2*normal_mv*(max(0.0f, dot(normal_mv,light_dir))) - light_dir);
-
-        if (height >= snowMin + epsilon) { // Only white snow
-            ambiant = snowKa * La;
-            diffuse = snowKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
-            specular = snowKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
-
-        } else if (height > snowMin) { // Gradient white snow and grey rock
-            float percentageGrey = ((snowMin + epsilon) - height)/epsilon;
-            float percentageWhite = 1.0 - percentageGrey;
-
-            ambiant = (percentageWhite * snowKa * La) + (percentageGrey* rockKa * La);
-            diffuse = (percentageWhite * snowKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld) + (percentageGrey*rockKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld);
-            specular = (percentageWhite*snowKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls) + (percentageGrey*rockKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls);
-
-        } else if (height > rockMin + epsilon) { // Only grey rock
-            ambiant  = rockKa * La;
-            diffuse = rockKd * (max(0.0f, dot(normal_mv, light_dir))) * Ld;
-            specular = rockKs * pow((max(0.0f, dot(r, view_dir))),default_alpha) * Ls;
-
-        } else if (height > rockMin) { // Gradient grey rock and grass
-            float percentageGreen = ((rockMin + epsilon) - height)/epsilon;
-            float percentageGrey = 1.0 - percentageGreen;
-
-            ambiant = (percentageGrey * rockKa * La) + (percentageGreen* grassKa * La);
-            diffuse = (percentageGrey * rockKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld) + (percentageGreen*grassKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld);
-            specular = (percentageGrey*rockKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls) + (percentageGreen*grassKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls);
-
-        } else if (height >= forestMin + epsilon) { // Only Grass
-            ambiant = grassKa * La;
-            diffuse = grassKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
-            specular = grassKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
-
-        } else if (height >= forestMin) { // Gradient grass and sand
-            float percentageSand = ((forestMin + epsilon) - height)/epsilon;
-            float percentageGreen = 1.0 - percentageSand;
-
-            ambiant = (percentageGreen * grassKa * La) + (percentageSand* sandKa * La);
-            diffuse = (percentageGreen * grassKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld) + (percentageSand*sandKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld);
-            specular = (percentageGreen*grassKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls) + (percentageSand*sandKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls);
-
-        } else if (height >= sandMin) { // Only sand
-            ambiant = sandKa * La;
-            diffuse = sandKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
-            specular = sandKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
-
-        } else if (height >= sandMin - epsilon) {
-            float percentageSeaBed = (sandMin - height)/epsilon;
-            float percentageSand = 1.0 - percentageSeaBed;
-
-            ambiant = (percentageSand* sandKa * La) + (percentageSeaBed* seaBedKa * La);
-            diffuse = (percentageSand* sandKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld) + (percentageSeaBed*seaBedKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld);
-            specular = (percentageSand*grassKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls) + (percentageSeaBed*seaBedKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls);
-
-        } else { // Only seabed
-            ambiant = seaBedKa * La;
-            diffuse = seaBedKd*(max(0.0f, dot(normal_mv, light_dir)))*Ld;
-            specular = seaBedKs*pow((max(0.0f, dot(r, view_dir))),default_alpha)*Ls;
-        }
-
-        if(isReflection) {
-            if (height < sandMin) {
-                color = vec4(0.0f, 0.0f, 0.0f, 0.0f);
-            } else {
-                color = vec4(ambiant + diffuse + specular, 1.0f);
-           }
-        } else {
-            color = vec4(ambiant + diffuse + specular, 1.0f);
+        color = vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    }
+#else
+    vec2 x1_temp = vec2(texture_coordinates.x-(1.0/heightmap_width), texture_coordinates.y);
+    vec2 x2_temp = vec2(texture_coordinates.x+(1.0/heightmap_width), texture_coordinates.y);
+
+    vec3 x1 = vec3(x1_temp, texture(heightMap, x1_temp).r);
+    vec3 x2 = vec3(x2_temp, texture(heightMap, x2_temp).r);
+
+    vec2 y1_temp = vec2(texture_coordinates.x, texture_coordinates.y-(1.0/heightmap_height));
+    vec2 y2_temp = vec2(texture_coordinates.x, texture_coordinates.y+(1.0/heightmap_height));
+
+    vec3 y1 = vec3(y1_temp, texture(heightMap, y1_temp).r);
+    vec3 y2 = vec3(y2_temp, texture(heightMap, y2_temp).r);
+
+    vec3 x = normalize(x2-x1);
+    vec3 y = normalize(y2-y1);
+    vec3 normal_mv = normalize(cross(x,y));
+    vec3 r = normalize(2*normal_mv*(max(0.0f, dot(normal_mv,light_dir))) - light_dir);
+
+    // only the materials present here are sampled. the branches depend on
+    // the fragment, so the gradients are taken beforehand.
+    vec4 splat = texture(splatMap, texture_coordinates);
+    float weights[NUM_MATERIALS] = float[](splat.r, splat.g, splat.b, splat.a,
+                                           max(0.0f, 1.0f - dot(splat, vec4(1.0f))));
+    vec2 uv_dx = dFdx(texture_coordinates);
+    vec2 uv_dy = dFdy(texture_coordinates);
+
+    vec3 Ka = vec3(0.0f);
+    vec3 Kd = vec3(0.0f);
+    vec3 Ks = vec3(0.0f);
+    float total = 0.0f;
+    for (int i = 0; i < NUM_MATERIALS; i++) {
+        if (weights[i] > minWeight) {
+            float tiling = materialTiling[i];
+            vec3 uvw = vec3(tiling * texture_coordinates, materialLayer[i]);
+            Ka += weights[i] * textureGrad(Materials, uvw, tiling * uv_dx, tiling * uv_dy).rgb;
+            Kd += weights[i] * materialKd[i];
+            Ks += weights[i] * materialKs[i];
+            total += weights[i];
         }
     }
+    Ka /= total;
+    Kd /= total;
+    Ks /= total;
+
+#ifdef GBUFFER
+    // lit later, once per pixel
+    float kd_bits = floor(clamp(Kd.r / materialKMax, 0.0f, 1.0f) * 15.0f + 0.5f);
+    float ks_bits = floor(clamp(Ks.r / materialKMax, 0.0f, 1.0f) * 15.0f + 0.5f);
+    albedo = vec4(Ka, (kd_bits * 16.0f + ks_bits) / 255.0f);
+    normal_oct = encodeNormal(normal_mv);
+#else
+    ambiant = Ka * La;
+    diffuse = Kd * (max(0.0f, dot(normal_mv, light_dir))) * Ld;
+    specular = Ks * pow((max(0.0f, dot(r, view_dir))), default_alpha) * Ls;
+
+    color = vec4(ambiant + diffuse + specular, 1.0f);
+#endif
+#endif
 
     // if (height < sandMin) {
     //     color = vec4(1.0f, 0.0f, 0.0f, 0.5f);
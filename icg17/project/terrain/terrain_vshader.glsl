@@ -1,65 +1,96 @@
 #version 330
+// compiled once per role (see Terrain): WATER, REFLECTION or the plain terrain,
+// GRID_BUFFER when the grid positions come from a vertex buffer
 
-in vec2 position;
-
+#ifdef GRID_BUFFER
+layout(location = 0) in vec2 position;
+#endif
+uniform int grid_dim;                  // cells on a side of the grid
 uniform sampler2D heightMap;
 uniform sampler2D waveheight;
 uniform sampler2D wavenormal;
-uniform mat4 projection;
 uniform mat4 model;
-uniform mat4 view;
-uniform vec3 light_pos;
-uniform bool isWater;
-uniform bool isReflection;
-uniform float time;
 uniform int row;
 uniform int col;
+uniform int next_row;
+uniform int next_col;
+uniform float wave_blend;
 uniform int height_mat_size;
+uniform vec4 clip_plane;
+uniform mat4 reflection_mvp;
+
+// shared by all the programs, see uniforms/uniform_buffer.h
+layout(std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
+layout(std140) uniform Light {
+    vec3 La, Ld, Ls;
+    vec3 light_pos;
+};
 
 out vec4 vpoint_mv;
 out vec3 light_dir, view_dir;
 out vec2 texture_coordinates;
 out vec3 wavenormal_vec;
 out mat4 mv;
+out vec4 reflection_clip;
+#ifdef REFLECTION
+out float gl_ClipDistance[1];
+#endif
+
+// the depth pre-pass and the shading pass must compute the same depth, the
+// shading keeps only the fragments equal to it
+invariant gl_Position;
 
 const float sandMin = 0.1322f; // Keep it consistant with a little bit more
 
 void main() {
+#ifndef GRID_BUFFER
+    // the grid has no vertex buffer: instance i draws row i of cells as one
+    // strip, its vertices alternating between the two edges of the row
+    ivec2 vertex = ivec2(gl_VertexID / 2, gl_InstanceID + gl_VertexID % 2);
+    vec2 position = vec2(vertex - grid_dim / 2) * (2.0 / float(grid_dim));
+#endif
+
     // World coordinates are from -1 to 1, we map them to texture coordinates
     // which are from 0 to 1.
     texture_coordinates = (position + vec2(1.0, 1.0)) * 0.5;
     float height = texture(heightMap, texture_coordinates).r;
     vec3 position3D;
 
-    if(isWater) {
-        vec2 uv = texture_coordinates * 0.996 + 0.002;
+#if defined(WATER)
+    vec2 uv = texture_coordinates * 0.996 + 0.002;
 
-        vec2 new_uv = (uv / float(height_mat_size)) + ((1.0f/float(height_mat_size)) * vec2(col, row));
-    
+    vec2 new_uv = (uv / float(height_mat_size)) + ((1.0f/float(height_mat_size)) * vec2(col, row));
+    vec2 next_uv = (uv / float(height_mat_size)) + ((1.0f/float(height_mat_size)) * vec2(next_col, next_row));
 
-        float height = sandMin + 0.001 * texture(waveheight, new_uv).z;
-        vec2 new_xy = (texture(waveheight, new_uv).xy * 2) - 1;
-        position3D = vec3(new_xy.x, height, new_xy.y);
+    // the atlas holds one frame every 1/fps s, blend the two around the time
+    vec3 wave = mix(texture(waveheight, new_uv).xyz, texture(waveheight, next_uv).xyz, wave_blend);
+    vec3 normal = mix(texture(wavenormal, new_uv).rgb, texture(wavenormal, next_uv).rgb, wave_blend);
 
-        wavenormal_vec = vec3(-texture(wavenormal, new_uv).r, -texture(wavenormal, new_uv).g, texture(wavenormal, new_uv).b);
+    float wave_height = sandMin + 0.001 * wave.z;
+    vec2 new_xy = (wave.xy * 2) - 1;
+    position3D = vec3(new_xy.x, wave_height, new_xy.y);
 
-    } else if (isReflection) {
-        wavenormal_vec = vec3(0,0,1); 
-        if (height < sandMin) {
-            position3D = vec3(position.x, sandMin + 0.0001, position.y);
-        } else {
-            position3D = vec3(position.x, (sandMin*2)-height,  position.y);
-        }
-    } else {
-        wavenormal_vec = vec3(0,0,1);
-        // 3D vertex position : X and Y from vertex array, Z from heightmap texture.
-        position3D = vec3(position.x, height, position.y);
-    }
+    wavenormal_vec = vec3(-normal.r, -normal.g, normal.b);
+#elif defined(REFLECTION)
+    wavenormal_vec = vec3(0,0,1);
+    // the model matrix mirrors the terrain, we only clip what is under water
+    position3D = vec3(position.x, height, position.y);
+    gl_ClipDistance[0] = dot(vec4(position3D, 1.0), clip_plane);
+#else
+    wavenormal_vec = vec3(0,0,1);
+    // 3D vertex position : X and Y from vertex array, Z from heightmap texture.
+    position3D = vec3(position.x, height, position.y);
+#endif
 
     mv = view * model;
     vpoint_mv = mv * vec4(position3D, 1.0);
 
     gl_Position = projection * vpoint_mv;
+    reflection_clip = reflection_mvp * vec4(position3D, 1.0);
 
     light_dir = normalize(light_pos - vpoint_mv.xyz);
     view_dir = normalize(position3D - vpoint_mv.xyz);
@@ -0,0 +1,185 @@
+#pragma once
+#include "icg_helper.h"
+#include <cstdint>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Textures baked offline by texbake: a header, a table giving the offset and
+// size of every mip level (largest first), then the block compressed levels.
+struct CompressedTextureHeader {
+    char magic[4];              // "CTEX"
+    uint32_t version;
+    uint32_t internal_format;   // GL_COMPRESSED_*_S3TC_*_EXT
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+};
+
+struct CompressedTextureLevel {
+    uint32_t offset;            // from the start of the file
+    uint32_t size;              // in bytes
+};
+
+static const char COMPRESSED_TEXTURE_MAGIC[4] = { 'C', 'T', 'E', 'X' };
+static const uint32_t COMPRESSED_TEXTURE_VERSION = 1;
+
+// read-only view of a baked texture, memory-mapped where possible so that
+// the levels go straight from the page cache to the driver
+class CompressedTextureFile {
+
+    private:
+        const unsigned char* data_ = nullptr;
+        size_t size_ = 0;
+        bool mapped_ = false;
+        std::vector<unsigned char> buffer_;     // used when mmap is unavailable
+
+        const CompressedTextureLevel &Level(int level) const {
+            return reinterpret_cast<const CompressedTextureLevel*>(
+                        data_ + sizeof(CompressedTextureHeader))[level];
+        }
+
+        bool Validate() const {
+            if(size_ < sizeof(CompressedTextureHeader)) {
+                return false;
+            }
+            const CompressedTextureHeader &header = Header();
+            if(memcmp(header.magic, COMPRESSED_TEXTURE_MAGIC, 4) != 0 ||
+               header.version != COMPRESSED_TEXTURE_VERSION || header.levels == 0 ||
+               sizeof(CompressedTextureHeader) +
+               header.levels * sizeof(CompressedTextureLevel) > size_) {
+                return false;
+            }
+            for (uint32_t level = 0; level < header.levels; level++) {
+                if(uint64_t(Level(level).offset) + Level(level).size > size_) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    public:
+        CompressedTextureFile() {}
+        CompressedTextureFile(const CompressedTextureFile&) = delete;
+        CompressedTextureFile &operator=(const CompressedTextureFile&) = delete;
+
+        ~CompressedTextureFile() {
+            Close();
+        }
+
+        // false when the file is missing or not a valid baked texture
+        bool Open(const string &filename) {
+            Close();
+#ifndef _WIN32
+            int fd = open(filename.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+            struct stat info;
+            if(fstat(fd, &info) == 0 && info.st_size > 0) {
+                void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(data != MAP_FAILED) {
+                    data_ = static_cast<const unsigned char*>(data);
+                    size_ = info.st_size;
+                    mapped_ = true;
+                }
+            }
+            close(fd);
+#else
+            ifstream stream(filename.c_str(), ios::in | ios::binary);
+            if(stream.is_open()) {
+                buffer_.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+                data_ = buffer_.empty() ? nullptr : &buffer_[0];
+                size_ = buffer_.size();
+            }
+#endif
+            if(data_ == nullptr || !Validate()) {
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        void Close() {
+#ifndef _WIN32
+            if(mapped_) {
+                munmap(const_cast<unsigned char*>(data_), size_);
+            }
+#endif
+            buffer_.clear();
+            data_ = nullptr;
+            size_ = 0;
+            mapped_ = false;
+        }
+
+        const CompressedTextureHeader &Header() const {
+            return *reinterpret_cast<const CompressedTextureHeader*>(data_);
+        }
+
+        int Levels() const {
+            return Header().levels;
+        }
+
+        int LevelWidth(int level) const {
+            return std::max(1, int(Header().width) >> level);
+        }
+
+        int LevelHeight(int level) const {
+            return std::max(1, int(Header().height) >> level);
+        }
+
+        const unsigned char* LevelData(int level) const {
+            return data_ + Level(level).offset;
+        }
+
+        GLsizei LevelSize(int level) const {
+            return GLsizei(Level(level).size);
+        }
+};
+
+// uploads the baked layers into the bound GL_TEXTURE_2D_ARRAY. false, with
+// nothing uploaded, when a file is missing, the layers do not match, or the
+// GPU has no S3TC support.
+inline bool LoadCompressedTextureArray(const vector<string> &filenames) {
+    if(!GLEW_EXT_texture_compression_s3tc) {
+        return false;
+    }
+
+    vector<CompressedTextureFile> files(filenames.size());
+    for (size_t layer = 0; layer < filenames.size(); layer++) {
+        if(!files[layer].Open(filenames[layer])) {
+            return false;
+        }
+        const CompressedTextureHeader &first = files[0].Header();
+        const CompressedTextureHeader &header = files[layer].Header();
+        if(header.internal_format != first.internal_format || header.width != first.width ||
+           header.height != first.height || header.levels != first.levels) {
+            return false;
+        }
+    }
+
+    const CompressedTextureFile &first = files[0];
+    GLsizei layers = GLsizei(files.size());
+    for (int level = 0; level < first.Levels(); level++) {
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.Header().internal_format,
+                               first.LevelWidth(level), first.LevelHeight(level), layers,
+                               0, first.LevelSize(level) * layers, NULL);
+        for (GLsizei layer = 0; layer < layers; layer++) {
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                      first.LevelWidth(level), first.LevelHeight(level), 1,
+                                      first.Header().internal_format,
+                                      files[layer].LevelSize(level), files[layer].LevelData(level));
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.Levels() - 1);
+    return true;
+}
+
+// where texbake puts the baked version of a texture: "rock.tga" -> "baked/rock.ctex"
+inline string BakedTextureName(const string &file) {
+    return "baked/" + file.substr(0, file.find_last_of('.')) + ".ctex";
+}
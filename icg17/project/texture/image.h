@@ -0,0 +1,108 @@
+#pragma once
+#include "icg_helper.h"
+#include <cstring>
+
+// 8 bit image in CPU memory, rows bottom to top as OpenGL expects them
+struct Image {
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// decodes an image file, optionally forcing the number of components. safe to
+// call from several threads at once.
+inline Image ReadImage(const string &filename, int components = 0) {
+    Image image;
+    unsigned char* data = stbi_load(filename.c_str(), &image.width, &image.height,
+                                    &image.components, components);
+    if(data == nullptr) {
+        throw(string("Failed to load texture ") + filename);
+    }
+    if(components != 0) {
+        image.components = components;
+    }
+
+    // flip the rows here rather than with stbi_set_flip_vertically_on_load,
+    // which is global state, to have the same coordinates as OpenGL
+    const int row = image.width * image.components;
+    image.pixels.resize(row * image.height);
+    for (int y = 0; y < image.height; y++) {
+        memcpy(&image.pixels[(image.height - 1 - y) * row], data + y * row, row);
+    }
+    stbi_image_free(data);
+    return image;
+}
+
+// the bilinearly filtered texel at texture coordinates (u, v), clamped to the
+// border, written to 'out' (one byte per component)
+inline void SampleImage(const Image &image, float u, float v, unsigned char* out) {
+    float src_x = glm::clamp(u * image.width - 0.5f, 0.0f, float(image.width - 1));
+    float src_y = glm::clamp(v * image.height - 0.5f, 0.0f, float(image.height - 1));
+    int x0 = int(src_x);
+    int y0 = int(src_y);
+    int x1 = std::min(x0 + 1, image.width - 1);
+    int y1 = std::min(y0 + 1, image.height - 1);
+    float fx = src_x - x0;
+    float fy = src_y - y0;
+
+    const int c = image.components;
+    const unsigned char* p00 = &image.pixels[(y0 * image.width + x0) * c];
+    const unsigned char* p10 = &image.pixels[(y0 * image.width + x1) * c];
+    const unsigned char* p01 = &image.pixels[(y1 * image.width + x0) * c];
+    const unsigned char* p11 = &image.pixels[(y1 * image.width + x1) * c];
+    for (int i = 0; i < c; i++) {
+        float top = p00[i] + fx * (p10[i] - p00[i]);
+        float bottom = p01[i] + fx * (p11[i] - p01[i]);
+        out[i] = (unsigned char)(top + fy * (bottom - top) + 0.5f);
+    }
+}
+
+// bilinear resampling, used to bring images to a common size
+inline Image ResampleImage(const Image &image, int width, int height) {
+    if(image.width == width && image.height == height) {
+        return image;
+    }
+
+    Image resampled;
+    resampled.width = width;
+    resampled.height = height;
+    resampled.components = image.components;
+    resampled.pixels.resize(width * height * image.components);
+
+    // at the pixel centers of the target
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            SampleImage(image, (x + 0.5f) / width, (y + 0.5f) / height,
+                        &resampled.pixels[(y * width + x) * image.components]);
+        }
+    }
+    return resampled;
+}
+
+// next level of a mip chain: 2x2 box filter, odd sizes round down
+inline Image DownsampleImage(const Image &image) {
+    Image half;
+    half.width = std::max(1, image.width / 2);
+    half.height = std::max(1, image.height / 2);
+    half.components = image.components;
+    half.pixels.resize(half.width * half.height * half.components);
+
+    const int c = image.components;
+    for (int y = 0; y < half.height; y++) {
+        int y0 = std::min(2 * y, image.height - 1);
+        int y1 = std::min(2 * y + 1, image.height - 1);
+        for (int x = 0; x < half.width; x++) {
+            int x0 = std::min(2 * x, image.width - 1);
+            int x1 = std::min(2 * x + 1, image.width - 1);
+            for (int i = 0; i < c; i++) {
+                int sum = image.pixels[(y0 * image.width + x0) * c + i] +
+                          image.pixels[(y0 * image.width + x1) * c + i] +
+                          image.pixels[(y1 * image.width + x0) * c + i] +
+                          image.pixels[(y1 * image.width + x1) * c + i];
+                half.pixels[(y * half.width + x) * c + i] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+    return half;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "icg_helper.h"
+#include <cstdint>
+
+// Writes 8 bit images as PNG without any dependency: the pixels are stored
+// in uncompressed deflate blocks, which every decoder reads. Rows go from the
+// bottom of the image up, as glReadPixels returns them.
+
+namespace png_writer {
+
+inline uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if(!table_ready) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        table_ready = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline void PutBigEndian(vector<unsigned char> &out, uint32_t value) {
+    out.push_back((value >> 24) & 0xFF);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+inline void PutChunk(ofstream &file, const char* type, const vector<unsigned char> &data) {
+    vector<unsigned char> chunk;
+    PutBigEndian(chunk, uint32_t(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    PutBigEndian(chunk, Crc32(&chunk[4], chunk.size() - 4));
+    file.write((const char*) &chunk[0], chunk.size());
+}
+
+// 'components' is 3 (RGB) or 4 (RGBA)
+inline bool WritePNG(const string &filename, int width, int height, int components,
+                     const unsigned char* pixels) {
+    ofstream file(filename.c_str(), ios::binary);
+    if(!file.is_open()) {
+        return false;
+    }
+    const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write((const char*) signature, sizeof(signature));
+
+    vector<unsigned char> header;
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    header.push_back(8);                            // bits per channel
+    header.push_back(components == 4 ? 6 : 2);      // RGBA or RGB
+    header.push_back(0);                            // deflate
+    header.push_back(0);                            // adaptive filtering
+    header.push_back(0);                            // not interlaced
+    PutChunk(file, "IHDR", header);
+
+    // every row starts with its filter type, none here
+    size_t row_size = size_t(width) * components;
+    vector<unsigned char> raw;
+    raw.reserve((row_size + 1) * height);
+    for (int y = height - 1; y >= 0; y--) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * row_size, pixels + (y + 1) * row_size);
+    }
+
+    // zlib stream of stored blocks, at most 65535 bytes each
+    vector<unsigned char> data;
+    data.push_back(0x78);
+    data.push_back(0x01);
+    size_t offset = 0;
+    do {
+        size_t size = std::min(raw.size() - offset, size_t(65535));
+        bool last = offset + size == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(size & 0xFF);
+        data.push_back((size >> 8) & 0xFF);
+        data.push_back(~size & 0xFF);
+        data.push_back((~size >> 8) & 0xFF);
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while(offset < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    PutBigEndian(data, (b << 16) | a);
+    PutChunk(file, "IDAT", data);
+
+    PutChunk(file, "IEND", vector<unsigned char>());
+    return file.good();
+}
+
+} // namespace png_writer
@@ -0,0 +1,248 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// [x_begin, x_end) x [y_begin, y_end), the tiles ParallelFor() hands out
+struct Range2D {
+    int x_begin;
+    int x_end;
+    int y_begin;
+    int y_end;
+};
+
+// Some work, and the job waiting for it: a job is finished once its own work
+// and every child created for it are.
+struct Job {
+    std::function<void()> work;
+    std::shared_ptr<Job> parent;
+    std::atomic<int> unfinished;        // itself and its unfinished children
+};
+
+typedef std::shared_ptr<Job> JobHandle;
+
+// Runs jobs on worker threads with one deque each. A worker runs the jobs it
+// queued itself newest first (the children of the job it just ran, their data
+// still in its cache) and, once out of them, steals the oldest job of another
+// queue. Other threads queue into a shared deque, and run jobs too while they
+// Wait(), so a system without workers runs everything on the waiting thread.
+class JobSystem {
+
+    public:
+        static const int ANY_WORKER = -1;
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<JobHandle> jobs;
+        };
+
+        // which system and queue the calling thread works for
+        struct ThreadSlot {
+            const JobSystem* system;
+            int worker;
+        };
+
+        std::vector<std::thread> workers_;
+        std::vector<std::unique_ptr<Queue> > queues_;  // one per worker, then the shared one
+        std::atomic<int> queued_;
+        std::atomic<int> sleeping_;
+        std::atomic<bool> stopping_;
+        std::mutex sleep_mutex_;
+        std::condition_variable wake_;
+
+        static ThreadSlot& CurrentThread() {
+            thread_local ThreadSlot slot = { NULL, ANY_WORKER };
+            return slot;
+        }
+
+        // the worker the calling thread is, ANY_WORKER for another thread
+        int CurrentWorker() const {
+            const ThreadSlot &slot = CurrentThread();
+            return slot.system == this ? slot.worker : ANY_WORKER;
+        }
+
+        void Push(int queue, const JobHandle &job) {
+            {
+                std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+                queues_[queue]->jobs.push_back(job);
+            }
+            queued_++;
+            // a worker going to sleep counts itself before checking queued_
+            if (sleeping_ > 0) {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+                wake_.notify_one();
+            }
+        }
+
+        // the newest job of the own queue, or the oldest of another one
+        JobHandle Pop(int worker) {
+            JobHandle job;
+            int num_queues = int(queues_.size());
+            if (worker != ANY_WORKER) {
+                std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+                if (!queues_[worker]->jobs.empty()) {
+                    job = queues_[worker]->jobs.back();
+                    queues_[worker]->jobs.pop_back();
+                }
+            }
+            int start = worker == ANY_WORKER ? num_queues - 1 : worker + 1;
+            for (int i = 0; !job && i < num_queues; i++) {
+                Queue &queue = *queues_[(start + i) % num_queues];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (!queue.jobs.empty()) {
+                    job = queue.jobs.front();
+                    queue.jobs.pop_front();
+                }
+            }
+            if (job) {
+                queued_--;
+            }
+            return job;
+        }
+
+        void Finish(const JobHandle &job) {
+            if (--job->unfinished == 0 && job->parent) {
+                Finish(job->parent);
+            }
+        }
+
+        void Execute(const JobHandle &job) {
+            if (job->work) {
+                job->work();
+            }
+            Finish(job);
+        }
+
+        void Work(int worker) {
+            CurrentThread().system = this;
+            CurrentThread().worker = worker;
+            while (!stopping_) {
+                JobHandle job = Pop(worker);
+                if (job) {
+                    Execute(job);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex_);
+                sleeping_++;
+                wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+                sleeping_--;
+            }
+        }
+
+    public:
+        JobSystem() : queued_(0), sleeping_(0), stopping_(false) {
+        }
+
+        // 'num_workers' < 0: one per core besides the calling thread
+        void Init(int num_workers = -1) {
+            if (num_workers < 0) {
+                num_workers = std::max(0, int(std::thread::hardware_concurrency()) - 1);
+            }
+            stopping_ = false;
+            for (int i = 0; i <= num_workers; i++) {
+                queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+            }
+            for (int i = 0; i < num_workers; i++) {
+                workers_.push_back(std::thread(&JobSystem::Work, this, i));
+            }
+        }
+
+        // jobs still queued are dropped, wait for the ones that matter first
+        void Cleanup() {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+                stopping_ = true;
+                wake_.notify_all();
+            }
+            for (size_t i = 0; i < workers_.size(); i++) {
+                workers_[i].join();
+            }
+            workers_.clear();
+            queues_.clear();
+            queued_ = 0;
+        }
+
+        // workers, plus the thread waiting
+        int NumThreads() const {
+            return int(workers_.size()) + 1;
+        }
+
+        // a job to Run(). a child has to be created before its parent is
+        // finished, from the parent's own work for instance.
+        JobHandle Create(const std::function<void()> &work,
+                         const JobHandle &parent = JobHandle()) {
+            JobHandle job = std::make_shared<Job>();
+            job->work = work;
+            job->parent = parent;
+            job->unfinished = 1;
+            if (parent) {
+                parent->unfinished++;
+            }
+            return job;
+        }
+
+        // 'worker' is a hint: the queue of that worker, so that jobs touching
+        // the same data run on the same core. by default the queue of the
+        // calling worker, or the shared one.
+        void Run(const JobHandle &job, int worker = ANY_WORKER) {
+            if (worker == ANY_WORKER) {
+                worker = CurrentWorker();
+            } else if (!workers_.empty()) {
+                worker %= int(workers_.size());
+            } else {
+                worker = ANY_WORKER;
+            }
+            Push(worker == ANY_WORKER ? int(queues_.size()) - 1 : worker, job);
+        }
+
+        bool Finished(const JobHandle &job) const {
+            return job->unfinished == 0;
+        }
+
+        // runs jobs until 'job' and its children are finished
+        void Wait(const JobHandle &job) {
+            while (!Finished(job)) {
+                JobHandle other = Pop(CurrentWorker());
+                if (other) {
+                    Execute(other);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        // calls 'work' on tiles of at most grain_x x grain_y covering 'range',
+        // in parallel, and returns once all are done. tile i goes to worker i,
+        // so that two loops over the same data split it the same way.
+        void ParallelFor(const Range2D &range, int grain_x, int grain_y,
+                         const std::function<void(const Range2D&)> &work) {
+            JobHandle root = Create(std::function<void()>());
+            int tile = 0;
+            for (int y = range.y_begin; y < range.y_end; y += grain_y) {
+                for (int x = range.x_begin; x < range.x_end; x += grain_x) {
+                    Range2D part = { x, std::min(x + grain_x, range.x_end),
+                                     y, std::min(y + grain_y, range.y_end) };
+                    Run(Create([&work, part] { work(part); }, root), tile++);
+                }
+            }
+            // the root has no work of its own
+            Finish(root);
+            Wait(root);
+        }
+
+        // calls 'work' on [begin, end) in pieces of at most 'grain'
+        void ParallelFor(int begin, int end, int grain,
+                         const std::function<void(int begin, int end)> &work) {
+            Range2D range = { begin, end, 0, 1 };
+            ParallelFor(range, grain, 1, [&work](const Range2D &part) {
+                work(part.x_begin, part.x_end);
+            });
+        }
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+
+// Hands the latest value from one writer thread to one reader thread, without
+// locks and without either side ever waiting. Of the three slots one is the
+// writer's, one the reader's and one is shared: Publish() swaps the writer's
+// slot with the shared one, Acquire() swaps the shared slot with the reader's
+// when it holds something new. The reader always sees a complete value, the
+// latest one, and skips the values published in between.
+template <typename T>
+class TripleBuffer {
+
+    private:
+        static const unsigned INDEX_MASK = 3;
+        static const unsigned FRESH = 4;        // the shared slot wasn't acquired yet
+
+        T slots_[3];
+        std::atomic<unsigned> shared_;          // index of the shared slot, and FRESH
+        unsigned write_ = 0;                    // only touched by the writer
+        unsigned read_ = 1;                     // only touched by the reader
+
+    public:
+        TripleBuffer() : shared_(2) {
+        }
+
+        // the slot to fill, it holds an older value: write all of it
+        T& Write() {
+            return slots_[write_];
+        }
+
+        void Publish() {
+            write_ = shared_.exchange(write_ | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        // false if nothing was published since the last call, Read() then
+        // still returns the previous value
+        bool Acquire() {
+            if (!(shared_.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+            read_ = shared_.exchange(read_, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+
+        const T& Read() const {
+            return slots_[read_];
+        }
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include "icg_helper.h"
+#include <glm/gtc/type_ptr.hpp>
+
+// binding points of the uniform blocks shared by the shaders
+static const GLuint FRAME_UNIFORMS_BINDING = 0;
+static const GLuint LIGHT_UNIFORMS_BINDING = 1;
+
+// layout(std140) uniform Frame, written once per frame. every member is
+// padded to a multiple of 16 bytes to match the std140 layout.
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    float time;
+    float padding[3];
+};
+
+// layout(std140) uniform Light, written once
+struct LightUniforms {
+    glm::vec4 La = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    glm::vec4 Ld = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    glm::vec4 Ls = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    glm::vec4 light_pos = glm::vec4(0.0f, 0.0f, 2.0f, 1.0f);   // camera space
+};
+
+// A uniform buffer object bound to a fixed binding point, where every program
+// declaring the matching block reads it.
+class UniformBuffer {
+
+    private:
+        GLuint buffer_id_;
+        GLsizeiptr size_;
+
+    public:
+        // buffers that are never updated are given their data here
+        void Init(GLuint binding, GLsizeiptr size, const void* data = NULL,
+                  GLenum usage = GL_DYNAMIC_DRAW) {
+            this->size_ = size;
+            glGenBuffers(1, &buffer_id_);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer_id_);
+            glBufferData(GL_UNIFORM_BUFFER, size_, data, usage);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_id_);
+        }
+
+        void Cleanup() {
+            glDeleteBuffers(1, &buffer_id_);
+        }
+
+        // replaces the whole content, orphaning the previous one so that
+        // draws still reading it do not stall the update
+        void Update(const void* data) {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer_id_);
+            glBufferData(GL_UNIFORM_BUFFER, size_, NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, size_, data);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+};
+
+// ties the named block of the program to its binding point, programs that do
+// not use the block are left alone
+inline void BindUniformBlock(GLuint program_id, const char* name, GLuint binding) {
+    GLuint block_index = glGetUniformBlockIndex(program_id, name);
+    if(block_index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program_id, block_index, binding);
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdint>
+#include <algorithm>
+
+// Block compression (S3TC) of 4x4 pixel blocks. Endpoints come from the
+// inset bounding box of the block colors, with the diagonal chosen from the
+// sign of the channel covariances; every pixel then takes the closest
+// palette entry.
+namespace bc_encoder {
+
+// 8 bit color to 5:6:5
+inline uint16_t PackRGB565(const int* color) {
+    return uint16_t(((color[0] * 31 + 127) / 255) << 11 |
+                    ((color[1] * 63 + 127) / 255) << 5 |
+                    ((color[2] * 31 + 127) / 255));
+}
+
+inline void UnpackRGB565(uint16_t packed, int* color) {
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// 'block' holds 16 RGBA pixels, writes the 8 byte BC1 color block. always
+// uses the four color mode, which BC3 requires as well.
+inline void EncodeColorBlock(const unsigned char* block, unsigned char* out) {
+    int lower[3] = { 255, 255, 255 };
+    int upper[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            lower[c] = std::min(lower[c], int(block[4 * i + c]));
+            upper[c] = std::max(upper[c], int(block[4 * i + c]));
+        }
+    }
+
+    // pick the bounding box diagonal the colors actually spread along
+    int center[3];
+    for (int c = 0; c < 3; c++) {
+        center[c] = (lower[c] + upper[c]) / 2;
+    }
+    int covariance_rg = 0;
+    int covariance_bg = 0;
+    for (int i = 0; i < 16; i++) {
+        int g = block[4 * i + 1] - center[1];
+        covariance_rg += (block[4 * i + 0] - center[0]) * g;
+        covariance_bg += (block[4 * i + 2] - center[2]) * g;
+    }
+    if (covariance_rg < 0) {
+        std::swap(lower[0], upper[0]);
+    }
+    if (covariance_bg < 0) {
+        std::swap(lower[2], upper[2]);
+    }
+
+    // inset the box by 1/16th to reduce the error in the middle
+    for (int c = 0; c < 3; c++) {
+        int inset = (upper[c] - lower[c]) / 16;
+        upper[c] = std::min(255, std::max(0, upper[c] - inset));
+        lower[c] = std::min(255, std::max(0, lower[c] + inset));
+    }
+
+    uint16_t color0 = PackRGB565(upper);
+    uint16_t color1 = PackRGB565(lower);
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            int best_error = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = block[4 * i + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < best_error) {
+                    best_error = error;
+                    best = p;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+// writes the 8 byte BC3 alpha block of 16 RGBA pixels, in the eight value mode
+inline void EncodeAlphaBlock(const unsigned char* block, unsigned char* out) {
+    int alpha0 = 0;
+    int alpha1 = 255;
+    for (int i = 0; i < 16; i++) {
+        alpha0 = std::max(alpha0, int(block[4 * i + 3]));
+        alpha1 = std::min(alpha1, int(block[4 * i + 3]));
+    }
+
+    uint64_t indices = 0;
+    if (alpha0 != alpha1) {
+        int palette[8] = { alpha0, alpha1 };
+        for (int p = 1; p < 7; p++) {
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            for (int p = 1; p < 8; p++) {
+                if (std::abs(block[4 * i + 3] - palette[p]) <
+                    std::abs(block[4 * i + 3] - palette[best])) {
+                    best = p;
+                }
+            }
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+
+    out[0] = (unsigned char)alpha0;
+    out[1] = (unsigned char)alpha1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+// compresses a whole image, 'alpha' selects BC3 instead of BC1. blocks
+// crossing the border repeat the last row/column.
+inline std::vector<unsigned char> Encode(const unsigned char* pixels, int width,
+                                         int height, int components, bool alpha) {
+    const int block_bytes = alpha ? 16 : 8;
+    const int blocks_x = (width + 3) / 4;
+    const int blocks_y = (height + 3) / 4;
+    std::vector<unsigned char> encoded(blocks_x * blocks_y * block_bytes);
+
+    unsigned char block[64];
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + i % 4, width - 1);
+                int y = std::min(by * 4 + i / 4, height - 1);
+                const unsigned char* pixel = pixels + (y * width + x) * components;
+                for (int c = 0; c < 3; c++) {
+                    block[4 * i + c] = pixel[std::min(c, components - 1)];
+                }
+                block[4 * i + 3] = components == 4 ? pixel[3] : 255;
+            }
+
+            unsigned char* out = &encoded[(by * blocks_x + bx) * block_bytes];
+            if (alpha) {
+                EncodeAlphaBlock(block, out);
+                out += 8;
+            }
+            EncodeColorBlock(block, out);
+        }
+    }
+    return encoded;
+}
+
+}
@@ -0,0 +1,75 @@
+// Bakes a texture for fast loading: resamples it, builds the whole mip chain,
+// compresses every level to BC1 (or BC3 when it has an alpha channel) and
+// writes them to a .ctex file the project memory-maps at startup.
+//
+//   texbake <input image> <output.ctex> [size]
+#include <GL/glew.h>
+
+// contains helper functions such as shader compiler
+#include "icg_helper.h"
+
+#include "../project/texture/image.h"
+#include "../project/texture/compressed_texture.h"
+#include "bc_encoder.h"
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s <input image> <output.ctex> [size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Image image;
+    try {
+        image = ReadImage(argv[1]);
+    } catch(const string &error) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    if(argc > 3) {
+        int size = atoi(argv[3]);
+        image = ResampleImage(image, size, size);
+    }
+
+    bool alpha = image.components == 4;
+    CompressedTextureHeader header;
+    memcpy(header.magic, COMPRESSED_TEXTURE_MAGIC, 4);
+    header.version = COMPRESSED_TEXTURE_VERSION;
+    header.internal_format = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                                   : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    header.width = image.width;
+    header.height = image.height;
+    header.levels = 1 + int(floor(log2(float(std::max(image.width, image.height)))));
+
+    // compress the mip chain, largest level first
+    vector<vector<unsigned char> > levels;
+    for (uint32_t level = 0; level < header.levels; level++) {
+        levels.push_back(bc_encoder::Encode(&image.pixels[0], image.width, image.height,
+                                            image.components, alpha));
+        image = DownsampleImage(image);
+    }
+
+    vector<CompressedTextureLevel> table(header.levels);
+    uint32_t offset = sizeof(CompressedTextureHeader) +
+                      header.levels * sizeof(CompressedTextureLevel);
+    for (uint32_t level = 0; level < header.levels; level++) {
+        table[level].offset = offset;
+        table[level].size = uint32_t(levels[level].size());
+        offset += table[level].size;
+    }
+
+    ofstream stream(argv[2], ios::out | ios::binary);
+    if(!stream.is_open()) {
+        fprintf(stderr, "Could not open file: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(&table[0]),
+                 table.size() * sizeof(CompressedTextureLevel));
+    for (uint32_t level = 0; level < header.levels; level++) {
+        stream.write(reinterpret_cast<const char*>(&levels[level][0]), levels[level].size());
+    }
+
+    fprintf(stdout, "%s: %dx%d, %d levels, %s, %u bytes\n", argv[2], header.width,
+            header.height, header.levels, alpha ? "BC3" : "BC1", offset);
+    return stream.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}